@@ -0,0 +1,15 @@
+#ifndef ALLOC_COUNTER_HPP
+#define ALLOC_COUNTER_HPP
+
+#include <cstddef>
+
+// Heap accounting through a replacement of the global operator new, which is
+// only compiled in when the executable defines NLP_COUNT_ALLOCS (bench always
+// does, model with -DNLP_COUNT_ALLOCS=ON). Without it, the counters stay 0.
+bool alloc_counting_enabled();
+// operator new calls so far
+size_t alloc_count();
+// usable bytes of the blocks currently allocated through operator new
+size_t alloc_live_bytes();
+
+#endif
@@ -1,20 +1,26 @@
 #ifndef ALPHABET_HPP
 #define ALPHABET_HPP
 
+#include "memory_usage.hpp"
 #include "string.hpp"
 
 #include <cassert>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 template <class TrueChar = char32_t, class SerialChar = uint32_t>
 class Alphabet {
 public:
   Alphabet(const std::unordered_set<TrueChar> &tcs);
+  // Rebuilds an alphabet from symbols() of another, keeping its serial order.
+  explicit Alphabet(const std::vector<TrueChar> &serialOrder);
 
   SerialChar serialize(TrueChar tc) const;
   TrueChar deserialize(SerialChar sc) const;
   SerialChar size() const;
+  std::vector<TrueChar> symbols() const;
+  MemoryUsage memory_usage() const;
 
 private:
   std::unordered_map<TrueChar, SerialChar> trueToSerial;
@@ -43,6 +49,18 @@ Alphabet<TrueChar, SerialChar>::Alphabet(
   }
 }
 
+template <class TrueChar, class SerialChar>
+Alphabet<TrueChar, SerialChar>::Alphabet(
+    const std::vector<TrueChar> &serialOrder)
+    : trueToSerial(serialOrder.size()), serialToTrue(serialOrder.size()) {
+  assert(serialOrder.size() >= 3 && serialOrder[0] == utf::BEG_STRING &&
+         serialOrder[1] == utf::END_STRING && serialOrder[2] == utf::UNKNOWN);
+  for (SerialChar sc = 0; sc < (SerialChar)serialOrder.size(); sc++) {
+    trueToSerial.insert_or_assign(serialOrder[sc], sc);
+    serialToTrue.insert_or_assign(sc, serialOrder[sc]);
+  }
+}
+
 template <class TrueChar, class SerialChar>
 SerialChar Alphabet<TrueChar, SerialChar>::serialize(TrueChar tc) const {
   auto result = trueToSerial.find(tc);
@@ -64,4 +82,21 @@ SerialChar Alphabet<TrueChar, SerialChar>::size() const {
   return (SerialChar)serialToTrue.size();
 }
 
+template <class TrueChar, class SerialChar>
+std::vector<TrueChar> Alphabet<TrueChar, SerialChar>::symbols() const {
+  std::vector<TrueChar> out(size());
+  for (SerialChar sc = 0; sc < size(); sc++) {
+    out[sc] = deserialize(sc);
+  }
+  return out;
+}
+
+template <class TrueChar, class SerialChar>
+MemoryUsage Alphabet<TrueChar, SerialChar>::memory_usage() const {
+  MemoryUsage usage;
+  usage.add("trueToSerial", memory::of(trueToSerial));
+  usage.add("serialToTrue", memory::of(serialToTrue));
+  return usage;
+}
+
 #endif
\ No newline at end of file
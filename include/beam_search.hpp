@@ -0,0 +1,158 @@
+#ifndef BEAM_SEARCH_HPP
+#define BEAM_SEARCH_HPP
+
+#include "string.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Beam search over model.probs(). Every step expands all live hypotheses as
+// one batch, split across pool if one is given, and keeps the width best
+// continuations. A continuation that ends the string is retired into the
+// finished list instead, and the search stops once width hypotheses have
+// finished or maxLen symbols have been produced. Hypotheses are ranked by
+// log2 probability divided by length^lengthPenalty, so 0 ranks by raw
+// probability and larger values favor longer strings.
+//
+// Hypotheses share their prefixes through a parent-linked history, so
+// extending one only copies its State window. The result does not depend on
+// the number of threads.
+template <class M>
+string32_t beam_search(const M &model, size_t maxLen, size_t width,
+                       double lengthPenalty, ThreadPool *pool = nullptr) {
+  using State = typename M::State;
+  struct Hypothesis {
+    State state;
+    double logprob;
+    size_t length;
+    // index into history of the last symbol, or SIZE_MAX when empty
+    size_t last;
+  };
+  struct Symbol {
+    size_t parent;
+    uint32_t c;
+  };
+  struct Candidate {
+    double logprob;
+    uint32_t hypothesis;
+    uint32_t c;
+  };
+
+  width = std::max<size_t>(width, 1);
+  const auto &alphabet = model.get_alphabet();
+  const uint32_t end = alphabet.serialize(utf::END_STRING);
+  auto score = [&](double logprob, size_t length) {
+    return logprob / std::pow((double)std::max<size_t>(length, 1),
+                              lengthPenalty);
+  };
+
+  size_t nTasks = pool ? pool->size() : 1;
+  std::vector<typename M::Workspace> workspaces(nTasks,
+                                                model.make_workspace());
+  std::vector<Symbol> history;
+  std::vector<Hypothesis> beam{{model.start(), 0.0, 0, SIZE_MAX}};
+  std::vector<Hypothesis> nextBeam;
+  std::vector<Hypothesis> finished;
+  // the best width continuations of each hypothesis, width entries apiece
+  std::vector<Candidate> expansions(width * width);
+  std::vector<Candidate> candidates;
+
+  auto worse = [](const Candidate &a, const Candidate &b) {
+    return a.logprob > b.logprob;
+  };
+  auto expand = [&](size_t t) {
+    for (size_t h = t; h < beam.size(); h += nTasks) {
+      const std::vector<double> &ps = model.probs(beam[h].state, workspaces[t]);
+      // min-heap of the best n symbols seen so far
+      Candidate *top = &expansions[h * width];
+      size_t n = std::min(width, ps.size());
+      for (uint32_t c = 0; c < ps.size(); c++) {
+        Candidate candidate{std::log2(ps[c]), (uint32_t)h, c};
+        if (c < n) {
+          top[c] = candidate;
+          std::push_heap(top, top + c + 1, worse);
+        } else if (candidate.logprob > top[0].logprob) {
+          std::pop_heap(top, top + n, worse);
+          top[n - 1] = candidate;
+          std::push_heap(top, top + n, worse);
+        }
+      }
+      for (size_t i = n; i < width; i++) {
+        top[i] = Candidate{-INFINITY, (uint32_t)h, end};
+      }
+    }
+  };
+
+  for (size_t step = 0; step < maxLen && !beam.empty(); step++) {
+    if (pool && beam.size() > 1) {
+      pool->run(std::min(nTasks, beam.size()), expand);
+    } else {
+      for (size_t t = 0; t < nTasks; t++) {
+        expand(t);
+      }
+    }
+
+    candidates.clear();
+    for (size_t i = 0; i < beam.size() * width; i++) {
+      if (expansions[i].logprob > -INFINITY) {
+        candidates.push_back(expansions[i]);
+        candidates.back().logprob += beam[expansions[i].hypothesis].logprob;
+      }
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate &a, const Candidate &b) {
+                if (a.logprob != b.logprob) {
+                  return a.logprob > b.logprob;
+                }
+                return a.hypothesis != b.hypothesis
+                           ? a.hypothesis < b.hypothesis
+                           : a.c < b.c;
+              });
+
+    nextBeam.clear();
+    for (const Candidate &candidate : candidates) {
+      const Hypothesis &parent = beam[candidate.hypothesis];
+      if (candidate.c == end) {
+        if (finished.size() < width) {
+          finished.push_back(Hypothesis{State(), candidate.logprob,
+                                        parent.length + 1, parent.last});
+        }
+      } else if (nextBeam.size() < width) {
+        history.push_back(Symbol{parent.last, candidate.c});
+        nextBeam.push_back(Hypothesis{
+            model.step(parent.state, alphabet.deserialize(candidate.c)),
+            candidate.logprob, parent.length + 1, history.size() - 1});
+      }
+      if (finished.size() == width && nextBeam.size() == width) {
+        break;
+      }
+    }
+    std::swap(beam, nextBeam);
+    if (finished.size() == width) {
+      break;
+    }
+  }
+
+  // Strings cut off at maxLen only compete when none finished.
+  const std::vector<Hypothesis> &ranked = finished.empty() ? beam : finished;
+  const Hypothesis *best = nullptr;
+  for (const Hypothesis &hypothesis : ranked) {
+    if (!best || score(hypothesis.logprob, hypothesis.length) >
+                     score(best->logprob, best->length)) {
+      best = &hypothesis;
+    }
+  }
+  string32_t out;
+  for (size_t i = best ? best->last : SIZE_MAX; i != SIZE_MAX;
+       i = history[i].parent) {
+    out.push_back(alphabet.deserialize(history[i].c));
+  }
+  std::reverse(out.begin(), out.end());
+  return out;
+}
+
+#endif
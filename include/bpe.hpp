@@ -0,0 +1,60 @@
+#ifndef BPE_HPP
+#define BPE_HPP
+
+#include "corpus.hpp"
+#include "memory_usage.hpp"
+#include "string.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Byte-pair-encoding subword tokenizer over code points. Text is first split
+// into chunks, a run of word characters (ASCII letters, digits and
+// apostrophes, and anything outside ASCII) with at most one space before it
+// or any other single code point, and merges never cross a chunk boundary.
+//
+// Merged tokens are written as code points from FIRST_TOKEN on, past the last
+// Unicode code point, and single characters stay themselves, so an encoded
+// poem is an ordinary string32_t: get_corpus_alphabet() builds an Alphabet
+// of tokens from an encoded corpus, and every model trains on it unchanged.
+class BpeTokenizer {
+public:
+  static const char32_t FIRST_TOKEN = 0x110000;
+
+  // Learns up to nMerges merges from corpus, most frequent pair first with
+  // ties going to the smaller pair, and stops early once no pair occurs
+  // twice. Pair counts are kept up to date incrementally, and a max-heap
+  // with lazy deletion picks each merge.
+  BpeTokenizer(const corpus_t &corpus, size_t nMerges);
+
+  // Applies the merges in the order they were learned, which reproduces
+  // training: chunks seen in training come from a table, others take the
+  // lowest-ranked adjacent pair until none is left.
+  string32_t encode(const string32_t &s) const;
+  corpus_t encode(const corpus_t &corpus) const;
+  string32_t decode(const string32_t &tokens) const;
+  // the characters a token stands for
+  string32_t expand(char32_t token) const;
+
+  size_t n_merges() const;
+  MemoryUsage memory_usage() const;
+
+private:
+  static uint64_t pair_key(char32_t left, char32_t right);
+  static std::vector<string32_t> chunks(const string32_t &s);
+  string32_t encode_chunk(const string32_t &chunk) const;
+
+private:
+  // merge i joins merges[i] into FIRST_TOKEN + i
+  std::vector<std::pair<char32_t, char32_t>> merges;
+  std::vector<string32_t> expansions;
+  // pair_key() of a merge's pair to its index
+  std::unordered_map<uint64_t, uint32_t> ranks;
+  // every training chunk, already encoded
+  std::unordered_map<string32_t, string32_t> known;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+#include <future>
+#include <string>
+#include <vector>
+
+// Plain-data image of a trained CustomNetModel. Nodes are referred to by id:
+// inputs are 0 .. windowLen - 1 and combos follow in creation order, so every
+// combo's parents come before it.
+struct Checkpoint {
+  struct Slot {
+    uint64_t node1;
+    uint64_t index1;
+    uint64_t node2;
+    uint64_t index2;
+  };
+  struct Combo {
+    Slot slot;
+    uint64_t xs[4];
+  };
+
+  uint64_t windowLen;
+  std::vector<char32_t> alphabet;
+  // windowLen rows of alphabet.size() counts
+  std::vector<uint64_t> inputXs;
+  std::vector<uint64_t> inputNs;
+  std::vector<Combo> combos;
+  // every taken slot, including those of pruned combos
+  std::vector<Slot> slots;
+  uint64_t nObserved;
+  // opaque position of whichever trainer wrote the checkpoint
+  std::vector<uint64_t> cursor;
+};
+
+// Both throw std::runtime_error on I/O failure or a malformed file. Writes go
+// to a temporary file that is renamed into place, so a crash mid-write never
+// clobbers the previous checkpoint.
+size_t write_checkpoint(const Checkpoint &checkpoint, const std::string &path);
+Checkpoint read_checkpoint(const std::string &path);
+
+// Writes checkpoints on a background thread, one at a time.
+class CheckpointWriter {
+public:
+  CheckpointWriter();
+  ~CheckpointWriter();
+
+  void write(Checkpoint checkpoint, const std::string &path);
+  void wait();
+  size_t last_bytes() const;
+  double last_seconds() const;
+
+private:
+  std::future<void> pending;
+  size_t lastBytes;
+  double lastSeconds;
+};
+
+#endif
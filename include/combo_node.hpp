@@ -3,21 +3,34 @@
 
 #include "node.hpp"
 
+#include <array>
+
 class ComboNode : public Node {
 public:
   ComboNode(Node &node1, size_t index1, Node &node2, size_t index2);
 
   double mutual_info() const;
+  // mutual information between the parents' bits, given the counts of a combo
+  static double mutual_info(const std::array<size_t, 4> &xs);
   Node &get_node1();
   Node &get_node2();
+  const Node &get_node1() const;
+  const Node &get_node2() const;
+  size_t get_index1() const;
+  size_t get_index2() const;
+  size_t n_observed() const;
+  void add_counts(const std::array<size_t, 4> &delta);
+  std::array<size_t, 4> counts() const;
+  void set_counts(const std::array<size_t, 4> &xs);
 
 public:
-  void observe() override;
-  void forward() override;
-  void backward(const std::unordered_set<Node *> &unknown) override;
+  void observe(const Activation &activation) override;
+  void forward(Activation &activation) const override;
+  void backward(Activation &activation) const override;
+  void refresh() override;
   std::vector<double> entropy() const override;
   std::vector<double> potential() const override;
-  size_t xs_index(bool bit1, bool bit2) const;
+  static size_t xs_index(bool bit1, bool bit2);
 
 private:
   Node &node1;
@@ -26,6 +39,12 @@ private:
   size_t index2;
   size_t xs[4];
   size_t n;
+  // log2(xs[i] / n), valid while !dirty
+  double logPs[4];
+  bool dirty;
+  // mutual_info() is only needed while training, so it is rebuilt on demand
+  mutable double mutualInfo;
+  mutable bool infoDirty;
 };
 
 #endif
\ No newline at end of file
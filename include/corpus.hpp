@@ -0,0 +1,25 @@
+#ifndef CORPUS_HPP
+#define CORPUS_HPP
+
+#include "alphabet.hpp"
+#include "memory_usage.hpp"
+#include "string.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+using corpus_t = std::vector<string32_t>;
+
+// Reads a UTF-8 file and splits it into poems at every delim.
+corpus_t load_corpus(const std::string &filepath,
+                     string32_t delim = U"\n#SEP#\n");
+// Splits a UTF-8 file like load_corpus(), but passes the poems to onPoem one
+// at a time instead of holding the whole file.
+void for_each_poem(const std::string &filepath,
+                   const std::function<void(const string32_t &)> &onPoem,
+                   string32_t delim = U"\n#SEP#\n");
+Alphabet<> get_corpus_alphabet(const corpus_t &corpus);
+MemoryUsage corpus_memory_usage(const corpus_t &corpus);
+
+#endif
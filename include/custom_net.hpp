@@ -2,24 +2,57 @@
 #define CUSTOM_NET_HPP
 
 #include "alphabet.hpp"
+#include "checkpoint.hpp"
 #include "combo_node.hpp"
 #include "input_node.hpp"
+#include "window.hpp"
 
+#include <array>
 #include <functional>
+#include <future>
 #include <list>
 #include <map>
 #include <memory>
 #include <set>
+#include <vector>
 
 class CustomNetModel {
 public:
-  using State = std::vector<uint32_t>;
-  struct OpenNode {
-    Node &node;
-    size_t index;
-    double potential;
+  using State = Window;
+
+  // Private copy of the additive counts, so that several workers can observe
+  // against the same graph structure and have their counts merged later.
+  struct Replica {
+    std::vector<std::vector<size_t>> inputXs;
+    std::vector<std::array<size_t, 4>> comboXs;
+    std::vector<bool> comboBits;
+    size_t nObserved;
+  };
+
+  // Activation and scratch buffers for answering one query at a time. A
+  // workspace is sized for one model version and only reallocates after the
+  // graph has changed, so steady-state queries do no heap allocation. Queries
+  // never write to the model, so threads with their own workspaces can query
+  // one model concurrently as long as nobody trains it meanwhile.
+  struct Workspace {
+    size_t version;
+    Activation activation;
+    std::vector<double> ps;
   };
 
+  // Combos that have seen at least minObservations and whose mutual info is
+  // below minMutualInfo are evicted every interval growth steps. Independently,
+  // the lowest-ranked combos are evicted after any growth step that leaves
+  // more than maxCombos. Zero disables the respective rule.
+  struct PruneConfig {
+    double minMutualInfo;
+    size_t maxCombos;
+    size_t minObservations;
+    size_t interval;
+  };
+
+  static const size_t GROWTH_INTERVAL = 1000;
+
 private:
   struct ComboSlot {
     Node &node1;
@@ -30,9 +63,26 @@ private:
     bool operator<(const ComboSlot &other) const;
   };
 
+  // An open node by id, and its potential.
+  struct OpenSlot {
+    size_t id;
+    size_t index;
+    double potential;
+  };
+
+  // The node statistics structure search reads, copied at a growth step so
+  // that the search can run beside training: the inputs, and the id and
+  // counts of each combo in level order.
+  struct GrowthSnapshot {
+    std::vector<InputNode> inputs;
+    std::vector<size_t> comboIds;
+    std::vector<std::array<size_t, 4>> comboXs;
+  };
+
 public:
   CustomNetModel(size_t windowLen,
                  const Alphabet<char32_t, uint32_t> &alphabet);
+  explicit CustomNetModel(const Checkpoint &checkpoint);
 
   InputNode &get_input_node(size_t index);
   void add_combo_node(Node &node1, size_t index1, Node &node2, size_t index2);
@@ -40,25 +90,76 @@ public:
   bool combo_possible(Node &node1, size_t index1, Node &node2, size_t index2);
   bool combo_possible(size_t index1, char32_t c1, size_t index2, char32_t c2);
 
-  State start();
-  void observe(State state, char32_t c);
-  State step(State state, char32_t c);
+  State start() const;
+  void observe(const State &state, char32_t c);
+  State step(State state, char32_t c) const;
   std::unordered_map<char32_t, double> probs(State state);
 
-  std::multiset<OpenNode,
-                std::function<bool(const OpenNode &, const OpenNode &)>>
-  open_nodes();
+  Workspace make_workspace() const;
+  const std::vector<double> &probs(const State &state,
+                                   Workspace &workspace) const;
+  double logprob(const State &state, char32_t c, Workspace &workspace) const;
+  // Rebuilds the nodes' cached log-probabilities after training so queries
+  // skip recomputing them. Merges and checkpoint loads do this already.
+  void refresh_caches();
+  const Alphabet<char32_t, uint32_t> &get_alphabet() const;
+  // probs() only reads the last context_size() symbols of a State, and its
+  // answers only change when revision() does.
+  size_t context_size() const;
+  size_t revision() const;
+
+  Checkpoint checkpoint(const std::vector<uint64_t> &cursor = {}) const;
+
+  void set_prune_config(const PruneConfig &config);
+  // Structure search ranks every open node by potential before each growth
+  // step. With background growth, the ranking for the next step is searched
+  // on another thread from a snapshot taken after this one, so the graph
+  // grows from counts one interval old and training only waits if a search
+  // outlasts a whole interval. The first step after enabling it, or after
+  // loading a checkpoint, searches synchronously. Checkpoints do not hold
+  // the pending search, and disabling it waits for that search to finish.
+  void set_background_growth(bool enabled);
+  size_t n_combos() const;
+  MemoryUsage memory_usage() const;
+
+  Replica make_replica() const;
+  void observe(Replica &replica, const State &state, char32_t c) const;
+  void merge(std::vector<Replica> &replicas);
 
   ostream8_t &desc_input(ostream8_t &os);
   ostream8_t &desc_combo(ostream8_t &os, size_t level);
 
+private:
+  void grow_combos();
+  GrowthSnapshot snapshot_growth();
+  // Ranks every open node by potential, highest first, either straight from
+  // the live nodes or from a snapshot on another thread.
+  std::vector<OpenSlot> search_growth() const;
+  static std::vector<OpenSlot> search_growth(const GrowthSnapshot &snapshot);
+  template <class Inputs, class ForEachCombo>
+  static std::vector<OpenSlot> rank_growth(const Inputs &inputs,
+                                           ForEachCombo forEachCombo);
+  void prune_combos(bool checkInfo);
+  void evict_descendants(std::vector<bool> &evict) const;
+  Node &get_node(size_t id);
+  void prepare(Workspace &workspace) const;
+
 private:
   Alphabet<char32_t, uint32_t> alphabet;
   std::list<InputNode> inputs;
   std::vector<typename std::list<InputNode>::iterator> serialInputs;
   std::map<size_t, std::shared_ptr<std::list<ComboNode>>> combos;
+  std::vector<ComboNode *> serialCombos;
   std::set<ComboSlot> comboSlots;
   size_t nObserved;
+  size_t version;
+  PruneConfig pruneConfig;
+  bool backgroundGrowth;
+  // the ranking for the next growth step, and the version it was taken at
+  std::future<std::vector<OpenSlot>> pendingSearch;
+  size_t searchVersion;
+  Workspace workspace;
+  Workspace trainWorkspace;
 };
 
 template <class Iter>
@@ -0,0 +1,139 @@
+#ifndef DISTRIBUTION_CACHE_HPP
+#define DISTRIBUTION_CACHE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bounded cache of a model's next-symbol distributions, keyed on the last
+// model.context_size() symbols of the State, which are all that probs()
+// reads. It is 4-way set-associative with LRU replacement inside each set,
+// and all storage is allocated up front, so lookups never allocate.
+//
+// Entries are tagged with model.revision() and the whole cache is dropped as
+// soon as the model changes, so it stays correct while training goes on, but
+// only pays off while the model is not being trained. One cache serves one
+// thread.
+template <class M> class DistributionCache {
+public:
+  using State = typename M::State;
+  using Workspace = typename M::Workspace;
+
+  static const size_t WAYS = 4;
+
+  // capacity is rounded up to a multiple of WAYS
+  DistributionCache(const M &model, size_t capacity);
+
+  // Same contract as model.probs(state, workspace).
+  const std::vector<double> &probs(const State &state, Workspace &workspace);
+  double logprob(const State &state, char32_t c, Workspace &workspace);
+
+  void clear();
+  size_t hits() const;
+  size_t misses() const;
+  double hit_rate() const;
+
+private:
+  uint64_t hash(const State &state) const;
+  bool matches(size_t entry, const State &state) const;
+
+private:
+  const M &model;
+  size_t nSets;
+  size_t contextSize;
+  size_t nSymbols;
+  size_t revision;
+  uint64_t tick;
+  std::vector<uint64_t> keys;
+  // 0 marks an empty entry, otherwise the tick of the last use
+  std::vector<uint64_t> lastUse;
+  std::vector<uint32_t> contexts;
+  std::vector<double> distributions;
+  size_t nHits;
+  size_t nMisses;
+};
+
+template <class M>
+DistributionCache<M>::DistributionCache(const M &model, size_t capacity)
+    : model(model),
+      nSets(std::max<size_t>((capacity + WAYS - 1) / WAYS, 1)),
+      contextSize(model.context_size()),
+      nSymbols(model.get_alphabet().size()), revision(model.revision()),
+      tick(0), keys(nSets * WAYS), lastUse(nSets * WAYS, 0),
+      contexts(nSets * WAYS * contextSize),
+      distributions(nSets * WAYS * nSymbols), nHits(0), nMisses(0) {}
+
+template <class M>
+const std::vector<double> &
+DistributionCache<M>::probs(const State &state, Workspace &workspace) {
+  if (model.revision() != revision) {
+    clear();
+    revision = model.revision();
+  }
+  tick++;
+  const uint64_t key = hash(state);
+  const size_t set = (size_t)(key % nSets) * WAYS;
+  size_t victim = set;
+  for (size_t entry = set; entry < set + WAYS; entry++) {
+    if (lastUse[entry] && keys[entry] == key && matches(entry, state)) {
+      nHits++;
+      lastUse[entry] = tick;
+      const double *cached = &distributions[entry * nSymbols];
+      workspace.ps.assign(cached, cached + nSymbols);
+      return workspace.ps;
+    }
+    if (lastUse[entry] < lastUse[victim]) {
+      victim = entry;
+    }
+  }
+
+  nMisses++;
+  const std::vector<double> &ps = model.probs(state, workspace);
+  keys[victim] = key;
+  lastUse[victim] = tick;
+  std::copy(state.end() - contextSize, state.end(),
+            contexts.begin() + victim * contextSize);
+  std::copy(ps.begin(), ps.end(), distributions.begin() + victim * nSymbols);
+  return ps;
+}
+
+template <class M>
+double DistributionCache<M>::logprob(const State &state, char32_t c,
+                                     Workspace &workspace) {
+  return std::log2(probs(state, workspace)[model.get_alphabet().serialize(c)]);
+}
+
+template <class M> void DistributionCache<M>::clear() {
+  std::fill(lastUse.begin(), lastUse.end(), 0);
+}
+
+template <class M> size_t DistributionCache<M>::hits() const { return nHits; }
+
+template <class M> size_t DistributionCache<M>::misses() const {
+  return nMisses;
+}
+
+template <class M> double DistributionCache<M>::hit_rate() const {
+  return nHits + nMisses ? (double)nHits / (nHits + nMisses) : 0.0;
+}
+
+// FNV-1a over the context symbols
+template <class M>
+uint64_t DistributionCache<M>::hash(const State &state) const {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (auto it = state.end() - contextSize; it != state.end(); it++) {
+    h = (h ^ *it) * 0x100000001b3ull;
+  }
+  return h ^ (h >> 29);
+}
+
+template <class M>
+bool DistributionCache<M>::matches(size_t entry,
+                                   const State &state) const {
+  return std::equal(state.end() - contextSize, state.end(),
+                    contexts.begin() + entry * contextSize);
+}
+
+#endif
@@ -0,0 +1,191 @@
+#ifndef EXTERNAL_NGRAM_HPP
+#define EXTERNAL_NGRAM_HPP
+
+#include "alphabet.hpp"
+#include "memory_usage.hpp"
+#include "window.hpp"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// One k-gram of an ExternalNGramCounter file and how often it was seen.
+struct NGramRecord {
+  uint64_t key;
+  uint64_t count;
+};
+
+// Out-of-core counting for NGramModel-style models. Each observation is one
+// order-n key: the window and the observed symbol packed most significant
+// first, ceil(log2(alphabet size)) bits each, so numeric order is
+// lexicographic order and every prefix of a key is a contiguous range.
+// Keys are buffered up to the memory budget, then sorted, aggregated and
+// written as a run file next to the output. write() merges the runs k ways,
+// in several passes if there are more than the budget can buffer, and emits
+// the order-n counts and, from their sorted prefixes, the counts of every
+// lower order in the same pass.
+//
+// The output holds one sorted (key, count) array per order, which
+// DiskNGramModel queries in place. The counts are exactly those of an
+// NGramModel of order n trained on the same sequences.
+//
+// ExternalNGramSorter does all of this on packed keys, and
+// ExternalNGramCounter adds the State that observations are made in.
+class ExternalNGramSorter {
+public:
+  // bytes per read or write, and per run buffered while merging
+  static const size_t BLOCK_BYTES = 1 << 20;
+  static const size_t DEFAULT_MEMORY_BUDGET = (size_t)256 << 20;
+
+  // n times the symbol width must fit in 64 bits, and memoryBudget must
+  // hold a few blocks. Runs are written to outputPath + ".runN" and removed
+  // by write(), or on destruction.
+  ExternalNGramSorter(size_t n, const Alphabet<char32_t, uint32_t> &alphabet,
+                      const std::string &outputPath,
+                      size_t memoryBudget = DEFAULT_MEMORY_BUDGET);
+  ~ExternalNGramSorter();
+  ExternalNGramSorter(const ExternalNGramSorter &) = delete;
+  ExternalNGramSorter &operator=(const ExternalNGramSorter &) = delete;
+
+  // Merges everything observed into outputPath and returns its size in
+  // bytes. Throws std::runtime_error on I/O failure.
+  size_t write();
+
+  size_t n_runs() const;
+  size_t n_observed() const;
+
+protected:
+  // c after the n - 1 symbols of window
+  void observe(const uint32_t *window, char32_t c);
+
+private:
+  void spill();
+  std::string run_path(size_t run) const;
+
+protected:
+  Alphabet<char32_t, uint32_t> alphabet;
+  size_t n;
+
+private:
+  unsigned bits;
+  std::string outputPath;
+  size_t memoryBudget;
+  std::vector<uint64_t> keys;
+  std::vector<std::string> runs;
+  size_t nextRun;
+  size_t nObserved;
+};
+
+// W is the State, the last n - 1 symbols: a FixedWindow picked by
+// dispatch_window(), or Window for any order.
+template <class W = Window>
+class ExternalNGramCounter : public ExternalNGramSorter {
+public:
+  using State = W;
+
+  // also throws std::runtime_error if W does not hold n - 1 symbols
+  ExternalNGramCounter(size_t n, const Alphabet<char32_t, uint32_t> &alphabet,
+                       const std::string &outputPath,
+                       size_t memoryBudget = DEFAULT_MEMORY_BUDGET)
+      : ExternalNGramSorter(n, alphabet, outputPath, memoryBudget) {
+    if (!W::fits(n - 1)) {
+      throw std::runtime_error("external ngram: order " + std::to_string(n) +
+                               " does not fit the window");
+    }
+  }
+
+  State start() const {
+    return State(n - 1, alphabet.serialize(utf::BEG_STRING));
+  }
+  State step(State state, char32_t c) const {
+    state.slide(alphabet.serialize(c));
+    return state;
+  }
+  void observe(const State &state, char32_t c) {
+    ExternalNGramSorter::observe(state.data(), c);
+  }
+};
+
+// Read-only n-gram counts in a file written by ExternalNGramCounter. The
+// file is mapped rather than read, so only the pages that queries touch are
+// ever loaded; lookups are binary searches in the per-order arrays.
+// DiskNGramModel adds the State that queries are made in.
+class NGramFile {
+public:
+  explicit NGramFile(const std::string &path, double smoothing = 0.01);
+  ~NGramFile();
+  NGramFile(const NGramFile &) = delete;
+  NGramFile &operator=(const NGramFile &) = delete;
+
+  const Alphabet<char32_t, uint32_t> &get_alphabet() const;
+  size_t get_n() const;
+
+  // distinct k-grams stored for order k, 1 <= k <= n
+  size_t n_records(size_t k) const;
+  size_t file_bytes() const;
+  // the mapping is not heap memory and is left out
+  MemoryUsage memory_usage() const;
+
+protected:
+  // the distribution after the n - 1 symbols of window, backed off and
+  // smoothed exactly like NGramModel::probs()
+  const std::vector<double> &probs(const uint32_t *window,
+                                   std::vector<double> &probs) const;
+
+protected:
+  Alphabet<char32_t, uint32_t> alphabet;
+  size_t n;
+
+private:
+  unsigned bits;
+  double smoothing;
+  void *mapping;
+  size_t mappingBytes;
+  // orders[k - 1] is the sorted array of order k
+  std::vector<const NGramRecord *> orders;
+  std::vector<size_t> orderSizes;
+};
+
+// An n-gram model over an NGramFile. W is the State as for
+// ExternalNGramCounter, and must hold the file's n - 1 symbols.
+template <class W = Window> class DiskNGramModel : public NGramFile {
+public:
+  using State = W;
+  struct Workspace {
+    std::vector<double> ps;
+  };
+
+  // also throws std::runtime_error if W does not fit the file's order
+  explicit DiskNGramModel(const std::string &path, double smoothing = 0.01)
+      : NGramFile(path, smoothing) {
+    if (!W::fits(n - 1)) {
+      throw std::runtime_error("external ngram: order " + std::to_string(n) +
+                               " of " + path + " does not fit the window");
+    }
+  }
+
+  State start() const {
+    return State(n - 1, alphabet.serialize(utf::BEG_STRING));
+  }
+  State step(State state, char32_t c) const {
+    state.slide(alphabet.serialize(c));
+    return state;
+  }
+  Workspace make_workspace() const {
+    return Workspace{std::vector<double>(alphabet.size())};
+  }
+  const std::vector<double> &probs(const State &state,
+                                   Workspace &workspace) const {
+    return NGramFile::probs(state.data(), workspace.ps);
+  }
+  double logprob(const State &state, char32_t c, Workspace &workspace) const {
+    return std::log2(probs(state, workspace)[alphabet.serialize(c)]);
+  }
+  size_t context_size() const { return n - 1; }
+  size_t revision() const { return 0; }
+};
+
+#endif
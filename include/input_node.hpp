@@ -1,28 +1,40 @@
 #ifndef INPUT_NODE_HPP
 #define INPUT_NODE_HPP
 
+#include "memory_usage.hpp"
 #include "node.hpp"
 
+#include <cstdint>
+
 class InputNode : public Node {
 public:
   explicit InputNode(size_t nWords);
 
-  void set_word(uint32_t word);
+  void set_word(Activation &activation, uint32_t word) const;
 
-  std::vector<double> probs() const;
-  std::vector<double> logprobs() const;
+  std::vector<double> probs(const Activation &activation) const;
+  void probs(const Activation &activation, double *out) const;
+  std::vector<double> logprobs(const Activation &activation) const;
+  const std::vector<size_t> &counts() const;
+  void add_counts(const std::vector<size_t> &delta);
+  void set_counts(const std::vector<size_t> &xs, size_t n);
+  size_t n_observed() const;
+  Footprint footprint() const;
 
 public:
-  void observe() override;
-  void forward() override;
-  void backward(const std::unordered_set<Node *> &unknown) override;
+  void observe(const Activation &activation) override;
+  void forward(Activation &activation) const override;
+  void backward(Activation &activation) const override;
+  void refresh() override;
   std::vector<double> entropy() const override;
   std::vector<double> potential() const override;
 
 private:
-  uint32_t word;
   std::vector<size_t> xs;
   size_t n;
+  // log2(xs[i] / n), valid while !dirty
+  std::vector<double> logPs;
+  bool dirty;
 };
 
-#endif
\ No newline at end of file
+#endif
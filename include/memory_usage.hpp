@@ -0,0 +1,127 @@
+#ifndef MEMORY_USAGE_HPP
+#define MEMORY_USAGE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Heap bytes held by part of a data structure. slack is the share of bytes
+// that is reserved but unused: vector capacity past size() and empty hash
+// buckets.
+struct Footprint {
+  size_t bytes;
+  size_t slack;
+
+  Footprint &operator+=(const Footprint &other) {
+    bytes += other.bytes;
+    slack += other.slack;
+    return *this;
+  }
+};
+
+// Estimated heap usage of a structure, broken down into named parts. The
+// estimates follow libstdc++'s container layouts and glibc's malloc block
+// sizes; build with NLP_COUNT_ALLOCS to check them against the real heap.
+class MemoryUsage {
+public:
+  struct Part {
+    std::string name;
+    Footprint footprint;
+  };
+
+  // Adding to an existing name accumulates.
+  void add(const std::string &name, const Footprint &footprint);
+  void add(const std::string &prefix, const MemoryUsage &usage);
+  Footprint total() const;
+  const std::vector<Part> &parts() const;
+
+  // One line per part, largest first.
+  std::string describe() const;
+
+private:
+  std::vector<Part> partList;
+};
+
+// 1234567 as "1.18 MiB"
+std::string format_bytes(size_t bytes);
+
+namespace memory {
+// usable size of the glibc malloc block that serves a request of bytes
+inline size_t heap_block(size_t bytes) {
+  return std::max<size_t>(24, (bytes + 8 + 15) / 16 * 16 - 8);
+}
+
+template <class T> Footprint of(const std::vector<T> &v) {
+  if (!v.capacity()) {
+    return {0, 0};
+  }
+  return {heap_block(v.capacity() * sizeof(T)),
+          (v.capacity() - v.size()) * sizeof(T)};
+}
+
+inline Footprint of(const std::vector<bool> &v) {
+  if (!v.capacity()) {
+    return {0, 0};
+  }
+  return {heap_block(v.capacity() / 8), (v.capacity() - v.size()) / 8};
+}
+
+template <class C> Footprint of(const std::basic_string<C> &s) {
+  // strings up to 15 bytes live inside the object
+  if (s.capacity() <= 15 / sizeof(C)) {
+    return {0, 0};
+  }
+  return {heap_block((s.capacity() + 1) * sizeof(C)),
+          (s.capacity() - s.size()) * sizeof(C)};
+}
+
+// Nodes and bucket array of a hash container, excluding heap memory owned by
+// the elements themselves. Non-integral keys cache their hash in the node.
+template <class H> Footprint hash_table(const H &h) {
+  using Key = typename H::key_type;
+  size_t node = sizeof(void *) + sizeof(typename H::value_type) +
+                (std::is_integral<Key>::value ? 0 : sizeof(size_t));
+  Footprint out{h.size() * heap_block(node), 0};
+  if (h.bucket_count() > 1) {
+    out.bytes += heap_block(h.bucket_count() * sizeof(void *));
+    out.slack = (h.bucket_count() - std::min(h.size(), h.bucket_count())) *
+                sizeof(void *);
+  }
+  return out;
+}
+
+template <class K, class V, class... Rest>
+Footprint of(const std::unordered_map<K, V, Rest...> &m) {
+  return hash_table(m);
+}
+
+template <class K, class... Rest>
+Footprint of(const std::unordered_set<K, Rest...> &s) {
+  return hash_table(s);
+}
+
+// Red-black tree nodes carry a color and three links ahead of the value.
+template <class K, class V, class... Rest>
+Footprint of(const std::map<K, V, Rest...> &m) {
+  return {m.size() * heap_block(4 * sizeof(void *) +
+                                sizeof(typename std::map<K, V>::value_type)),
+          0};
+}
+
+template <class K, class... Rest> Footprint of(const std::set<K, Rest...> &s) {
+  return {s.size() * heap_block(4 * sizeof(void *) + sizeof(K)), 0};
+}
+
+template <class T> Footprint of(const std::list<T> &l) {
+  return {l.size() * heap_block(2 * sizeof(void *) + sizeof(T)), 0};
+}
+} // namespace memory
+
+#endif
@@ -2,23 +2,97 @@
 #define NGRAM_HPP
 
 #include "alphabet.hpp"
+#include "window.hpp"
 
+#include <array>
 #include <memory>
 #include <unordered_map>
 #include <vector>
 
 class NGramModel {
 public:
-  using State = std::vector<uint32_t>;
+  // The last n - 1 symbols, oldest first. Training works on windows, since
+  // observe() counts every prefix of one. The training functions take any
+  // window type, so a FixedWindow picked by dispatch_window() can stand in.
+  using Window = ::Window;
+  // Cursor for queries: the trie node of the longest suffix of everything
+  // stepped through that was seen as a context. It is all probs() reads, so
+  // context_size() is its size and a DistributionCache keys on it.
+  using State = std::array<uint32_t, 1>;
+  struct Workspace {
+    std::vector<double> ps;
+  };
+
+  // How often a symbol followed a context, and how often the context was
+  // followed by anything.
+  struct Evidence {
+    size_t count;
+    size_t total;
+  };
+
+  static constexpr double DEFAULT_SMOOTHING = 0.01;
 
 public:
-  NGramModel(size_t n, const Alphabet<char32_t, uint32_t> &alphabet);
+  // smoothing is the additive constant given to every symbol of a context
+  NGramModel(size_t n, const Alphabet<char32_t, uint32_t> &alphabet,
+             double smoothing = DEFAULT_SMOOTHING);
+
+  template <class W = Window> W start_window() const {
+    return W(n - 1, alphabet.serialize(utf::BEG_STRING));
+  }
+  template <class W> W slide(W window, char32_t c) const {
+    window.slide(alphabet.serialize(c));
+    return window;
+  }
+  template <class W> void observe(const W &window, char32_t c) {
+    observe_window(window.data(), c);
+  }
 
-  State start();
-  void observe(State state, char32_t c);
-  State step(State state, char32_t c);
+  // Precomputes every context node's suffix link, i.e. the node of its
+  // longest proper suffix that is a context too, after training. step() then
+  // takes one child lookup plus a link per context symbol it drops, so
+  // amortized O(1) per symbol for any n. Queries stay correct once observe()
+  // adds nodes, only slower, until this is called again.
+  void link();
+
+  State start() const;
+  State step(State state, char32_t c) const;
   std::unordered_map<char32_t, double> probs(State state);
 
+  Workspace make_workspace() const;
+  const std::vector<double> &probs(const State &state,
+                                   Workspace &workspace) const;
+  double logprob(const State &state, char32_t c, Workspace &workspace) const;
+  // Same answers for the State stepped through the same symbols, found by
+  // walking the trie from the root once per order; for callers that cannot
+  // hold a cursor while the trie grows.
+  const std::vector<double> &probs(const Window &window,
+                                   Workspace &workspace) const;
+  double logprob(const Window &window, char32_t c,
+                 Workspace &workspace) const;
+  const Alphabet<char32_t, uint32_t> &get_alphabet() const;
+  size_t get_n() const;
+  double get_smoothing() const;
+  // probs() only reads the last context_size() entries of a State, and its
+  // answers only change when revision() does.
+  size_t context_size() const;
+  size_t revision() const;
+
+  // Observes n - 1 padding symbols after the last character of a sequence
+  // (window is the window after it), so that its final k-grams also start
+  // some order-n window. evidence() needs this to count lower orders exactly.
+  template <class W> void finish(W window) {
+    for (size_t k = 1; k < n; k++) {
+      observe(window, utf::BEG_STRING);
+      window = slide(window, utf::BEG_STRING);
+    }
+  }
+  // Fills out[k - 1] with the evidence an order-k model backs off to when
+  // predicting c after state, for every k from 1 to n. The counts come from
+  // this model's own trie, so one order-n model answers for all lower orders.
+  void evidence(const State &state, char32_t c, Evidence *out) const;
+  MemoryUsage memory_usage() const;
+
 private:
   struct Mappee {
     size_t count;
@@ -27,13 +101,31 @@ private:
 
   using Map = std::unordered_map<uint32_t, Mappee>;
 
+  // where a context node hangs in the trie
+  struct Node {
+    uint32_t parent;
+    uint32_t symbol;
+    uint32_t depth;
+  };
+
 private:
+  // c after the n - 1 symbols of window
+  void observe_window(const uint32_t *window, char32_t c);
   static size_t map_total(const Map &map);
+  void fill_probs(const Map &map, std::vector<double> &probs) const;
+  uint32_t suffix_link(uint32_t node) const;
 
 private:
   Alphabet<char32_t, uint32_t> alphabet;
   size_t n;
+  double smoothing;
+  size_t nObserved;
   std::vector<Map> maps;
+  // parallel to maps
+  std::vector<Node> nodes;
+  // parallel to maps as of the last link()
+  std::vector<uint32_t> links;
+  Workspace workspace;
 };
 
 #endif
\ No newline at end of file
@@ -1,36 +1,61 @@
 #ifndef NODE_HPP
 #define NODE_HPP
 
-#include <unordered_set>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 
+// Per-evaluation node state: the current input words, which nodes are
+// unknown, forward bits and backward messages. Nodes only read their learned
+// counts while evaluating, so one trained graph can be evaluated against many
+// activations at once. Node id owns n_outputs() consecutive slots of the
+// per-output arrays, starting at offsets[id].
+struct Activation {
+  std::vector<size_t> offsets;
+  std::vector<uint32_t> words;
+  std::vector<bool> unknown;
+  std::vector<bool> forwardBits;
+  std::vector<double> backwardLogPs;
+  std::vector<size_t> backwardCounts;
+};
+
 class Node {
 public:
   Node(size_t level, size_t nInputs, size_t nOutputs);
   virtual ~Node();
 
 public:
+  size_t get_id() const;
+  void set_id(size_t id);
   size_t get_level() const;
   void set_level(size_t level);
-  bool get_forward_bit(size_t index) const;
-  void contribute_backward_loglh(size_t index, double loglh);
-  double get_backward_logprob(size_t index) const;
-  void clear_backward();
+  bool get_forward_bit(const Activation &activation, size_t index) const;
+  void contribute_backward_loglh(Activation &activation, size_t index,
+                                 double loglh) const;
+  double get_backward_logprob(const Activation &activation,
+                              size_t index) const;
+  void clear_backward(Activation &activation) const;
   size_t n_inputs() const;
   size_t n_outputs() const;
 
 public:
-  virtual void observe() = 0;
-  virtual void forward() = 0;
-  virtual void backward(const std::unordered_set<Node *> &unknown) = 0;
+  virtual void observe(const Activation &activation) = 0;
+  virtual void forward(Activation &activation) const = 0;
+  virtual void backward(Activation &activation) const = 0;
+  // Rebuilds cached values derived from the counts. Evaluation stays correct
+  // without it, only slower, and never writes to the node.
+  virtual void refresh() = 0;
   virtual std::vector<double> entropy() const = 0;
   virtual std::vector<double> potential() const = 0;
 
 protected:
-  std::vector<bool> forwardBits;
-  std::vector<double> backwardLogPs;
-  std::vector<size_t> backwardCounts;
+  size_t slot(const Activation &activation, size_t index) const;
+
+protected:
+  size_t nInputs;
+  size_t nOutputs;
+  size_t id;
   size_t level;
 };
 
-#endif
\ No newline at end of file
+#endif
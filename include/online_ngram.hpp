@@ -0,0 +1,79 @@
+#ifndef ONLINE_NGRAM_HPP
+#define ONLINE_NGRAM_HPP
+
+#include "ngram.hpp"
+
+#include <array>
+#include <atomic>
+#include <utility>
+
+// An NGramModel that keeps learning while it serves queries. One writer
+// thread observes into a private copy and publishes it every publishInterval
+// observations (or on publish()); reader threads query the published copy
+// through a Reader and never block or take a lock.
+//
+// Publishing is left-right: there are two copies, the writer swaps which one
+// is published, waits until no reader can still be inside the old one, and
+// then replays the batch it just published onto it.
+class OnlineNGramModel {
+public:
+  // Windows rather than cursors, since the trie a cursor points into keeps
+  // growing under the readers.
+  using State = NGramModel::Window;
+  using Workspace = NGramModel::Workspace;
+
+  static const size_t MAX_READERS = 64;
+
+  class Reader {
+  public:
+    explicit Reader(const OnlineNGramModel &model);
+    ~Reader();
+    Reader(const Reader &) = delete;
+    Reader &operator=(const Reader &) = delete;
+
+    const std::vector<double> &probs(const State &state,
+                                     Workspace &workspace) const;
+    double logprob(const State &state, char32_t c, Workspace &workspace) const;
+
+  private:
+    const NGramModel &enter() const;
+    void leave() const;
+
+  private:
+    const OnlineNGramModel &model;
+    size_t slot;
+  };
+
+public:
+  OnlineNGramModel(size_t n, const Alphabet<char32_t, uint32_t> &alphabet,
+                   size_t publishInterval);
+
+  State start() const;
+  State step(State state, char32_t c) const;
+  Workspace make_workspace() const;
+  const Alphabet<char32_t, uint32_t> &get_alphabet() const;
+
+  // writer thread only
+  void observe(State state, char32_t c);
+  void publish();
+
+  size_t version() const;
+  MemoryUsage memory_usage() const;
+
+private:
+  // one per cache line, since every reader writes its own on each query
+  struct alignas(64) ReaderSlot {
+    std::atomic<bool> taken;
+    std::atomic<uint64_t> epoch;
+  };
+
+private:
+  std::array<NGramModel, 2> copies;
+  std::atomic<size_t> front;
+  std::atomic<uint64_t> epoch;
+  mutable std::array<ReaderSlot, MAX_READERS> readerSlots;
+  std::vector<std::pair<State, char32_t>> pending;
+  size_t publishInterval;
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef PERF_REPORT_HPP
+#define PERF_REPORT_HPP
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Flat JSON object of named metrics from one end-to-end run, e.g.
+//   {"train.seconds": 1.5, "train.chars_per_s": 144000, "perplexity": 31.04}
+// Names ending in .seconds, _kb or _bytes are costs, names ending in _per_s
+// are rates, and anything else is a result that a deterministic run must
+// reproduce.
+class PerfReport {
+public:
+  void set(const std::string &name, double value);
+  bool get(const std::string &name, double &value) const;
+
+  void write(const std::string &path) const;
+  static PerfReport read(const std::string &path);
+
+  // Prints every metric next to its baseline value and returns false if a
+  // cost grew or a rate shrank by more than tolerance (relative), or if a
+  // result changed at all, or if a baseline metric is missing from this
+  // run.
+  bool compare(const PerfReport &baseline, double tolerance,
+               std::ostream &os) const;
+
+private:
+  std::vector<std::pair<std::string, double>> metrics;
+};
+
+// Peak resident set size of this process so far, in KiB.
+size_t peak_rss_kb();
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef PHILOX_HPP
+#define PHILOX_HPP
+
+#include <cstdint>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random
+// Numbers: As Easy as 1, 2, 3"). The seed is the key and the stream id is
+// half of the counter, so every (seed, stream) pair is an independent
+// sequence that can be started on any thread without shared state, and a
+// stream produces the same numbers however streams are scheduled.
+class Philox {
+public:
+  Philox(uint64_t seed, uint64_t stream)
+      : key{(uint32_t)seed, (uint32_t)(seed >> 32)}, stream(stream), block(0),
+        used(4) {}
+
+  uint32_t next_u32() {
+    if (used == 4) {
+      refill();
+    }
+    return out[used++];
+  }
+
+  uint64_t next_u64() {
+    uint64_t hi = next_u32();
+    return hi << 32 | next_u32();
+  }
+
+  // uniform in [0, 1) with 53 random bits
+  double uniform() { return (next_u64() >> 11) * 0x1.0p-53; }
+
+private:
+  void refill() {
+    uint32_t c[4] = {(uint32_t)block, (uint32_t)(block >> 32),
+                     (uint32_t)stream, (uint32_t)(stream >> 32)};
+    uint32_t k[2] = {key[0], key[1]};
+    for (int round = 0; round < 10; round++) {
+      uint64_t p0 = (uint64_t)0xD2511F53u * c[0];
+      uint64_t p1 = (uint64_t)0xCD9E8D57u * c[2];
+      uint32_t next[4] = {(uint32_t)(p1 >> 32) ^ c[1] ^ k[0], (uint32_t)p1,
+                          (uint32_t)(p0 >> 32) ^ c[3] ^ k[1], (uint32_t)p0};
+      for (int i = 0; i < 4; i++) {
+        c[i] = next[i];
+      }
+      k[0] += 0x9E3779B9u;
+      k[1] += 0xBB67AE85u;
+    }
+    for (int i = 0; i < 4; i++) {
+      out[i] = c[i];
+    }
+    block++;
+    used = 0;
+  }
+
+private:
+  uint32_t key[2];
+  uint64_t stream;
+  uint64_t block;
+  uint32_t out[4];
+  unsigned used;
+};
+
+#endif
@@ -1,19 +1,60 @@
 #ifndef PROGRESS_HPP
 #define PROGRESS_HPP
 
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+#include <string>
+
+// Progress of a task over total items, reported on std::cerr. add() and set()
+// are cheap and thread-safe; the report is redrawn at most once per interval.
+//
+// BAR draws a bar with throughput and ETA in place. LOG writes one logfmt
+// line per interval for log collectors, e.g.
+//   progress task=train items=40 total=157 chars=43210 elapsed_s=12.0
+//   items_per_s=3.33 chars_per_s=3600.8 eta_s=35.1
+// AUTO picks BAR when std::cerr is a terminal and LOG otherwise.
 class Progress {
 public:
-  Progress(size_t total);
+  enum class Mode { AUTO, BAR, LOG, NONE };
+
+  // start is the count already done when the task resumes, which does not
+  // count towards throughput.
+  Progress(size_t total, const std::string &task = "progress",
+           size_t start = 0);
   ~Progress();
 
-  void set(size_t count);
-  void add(size_t count);
+  void set(size_t count, size_t chars = 0);
+  void add(size_t count, size_t chars = 0);
   void update();
 
+  static void set_mode(Mode mode);
+  static void set_interval(std::chrono::milliseconds interval);
+  // "auto", "bar", "log" or "none"; throws std::runtime_error otherwise
+  static Mode parse_mode(const std::string &name);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  Clock::duration interval() const;
+  void maybe_update();
+  void draw_bar(double elapsed, double itemsPerS, double charsPerS,
+                double eta);
+  void draw_log(double elapsed, double itemsPerS, double charsPerS,
+                double eta);
+
 private:
-  size_t count;
+  std::atomic<size_t> count;
+  std::atomic<size_t> chars;
   size_t total;
+  size_t start;
   size_t width;
+  std::string task;
+  Mode mode;
+  Clock::time_point begin;
+  std::atomic<Clock::rep> nextDraw;
+  std::mutex drawMutex;
 };
 
-#endif
\ No newline at end of file
+#endif
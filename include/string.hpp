@@ -119,6 +119,27 @@ void write_utf8(char32_t codePoint, ostream8_t &ofs);
 void write_utf16(char32_t codePoint, ostream16_t &ofs);
 void write_utf32(char32_t codePoint, ostream32_t &ofs);
 
+// Appends the UTF-8 encoding of codePoint to out, as write_utf8() writes it.
+void append_utf8(char32_t codePoint, string8_t &out);
+
+// Encodes into a byte buffer and hands it to the stream in large blocks
+// instead of one put() per byte. Flushes when destroyed.
+class Utf8Writer {
+public:
+  static const size_t BUFFER_SIZE = 1 << 16;
+
+  explicit Utf8Writer(ostream8_t &ofs);
+  ~Utf8Writer();
+
+  void write(char32_t codePoint);
+  void write(const string32_t &s);
+  void flush();
+
+private:
+  ostream8_t &ofs;
+  string8_t buffer;
+};
+
 template <class char_t>
 char_t encode_chunk(char32_t codePoint, uint8_t offset, char_t mask,
                     char_t signal) {
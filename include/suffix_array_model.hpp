@@ -0,0 +1,89 @@
+#ifndef SUFFIX_ARRAY_MODEL_HPP
+#define SUFFIX_ARRAY_MODEL_HPP
+
+#include "alphabet.hpp"
+#include "corpus.hpp"
+#include "memory_usage.hpp"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// Unbounded-order n-gram model over a suffix array of the training corpus.
+// Every poem is stored as BEG_STRING, its symbols and END_STRING, one byte
+// per symbol, next to the sorted suffix start positions, so the index takes
+// 5 bytes per corpus symbol and there are no counts to store: the suffixes
+// that start with a context form one interval of the suffix array, and its
+// size is the context's count.
+//
+// The context used for a prediction is the longest suffix of everything
+// since start() that occurs at least minCount times in the corpus, and the
+// prediction is its continuation counts with additive smoothing, as in
+// NGramModel.
+class SuffixArrayModel {
+public:
+  // {lo, hi, depth}: the suffix array interval [lo, hi) of the suffixes that
+  // start with the matched context, and the context's length. It determines
+  // probs() entirely, so context_size() is its size and a DistributionCache
+  // keys on the whole State.
+  using State = std::array<uint32_t, 3>;
+  struct Workspace {
+    std::vector<double> ps;
+  };
+
+  static const size_t LO = 0;
+  static const size_t HI = 1;
+  static const size_t DEPTH = 2;
+  static constexpr double DEFAULT_SMOOTHING = 0.01;
+
+public:
+  // The alphabet must have at most 256 symbols, and the corpus fewer than
+  // 2^32 once separated.
+  SuffixArrayModel(const corpus_t &corpus,
+                   const Alphabet<char32_t, uint32_t> &alphabet,
+                   size_t minCount = 1, double smoothing = DEFAULT_SMOOTHING);
+
+  State start() const;
+  // One refinement of the interval, O(log N), when the longer context still
+  // occurs often enough. Otherwise a binary search over how many symbols of
+  // the d-symbol context to keep, where each probe is a binary search of the
+  // suffix array comparing up to d symbols per suffix: O(d log d log N)
+  // symbol comparisons in the worst case, though each is a memcmp.
+  State step(const State &state, char32_t c) const;
+
+  Workspace make_workspace() const;
+  // O(k log N) for k distinct continuations of the context.
+  const std::vector<double> &probs(const State &state,
+                                   Workspace &workspace) const;
+  // O(log N): only counts c.
+  double logprob(const State &state, char32_t c, Workspace &workspace) const;
+  const Alphabet<char32_t, uint32_t> &get_alphabet() const;
+  size_t get_min_count() const;
+  double get_smoothing() const;
+  size_t context_size() const;
+  size_t revision() const;
+  // number of symbols indexed, separators included
+  size_t size() const;
+
+  MemoryUsage memory_usage() const;
+
+private:
+  State root() const;
+  // the interval of the context of state followed by sc, possibly empty
+  State refine(const State &state, uint32_t sc) const;
+  // the interval of text[pos, pos + length) followed by sc, possibly empty,
+  // found with one binary search over whole suffixes
+  State find(uint32_t pos, uint32_t length, uint32_t sc) const;
+  // first index of the interval whose suffix continues past the context
+  uint32_t first_continued(const State &state) const;
+  void build();
+
+private:
+  Alphabet<char32_t, uint32_t> alphabet;
+  size_t minCount;
+  double smoothing;
+  std::vector<uint8_t> text;
+  std::vector<uint32_t> suffixes;
+};
+
+#endif
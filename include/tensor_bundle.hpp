@@ -0,0 +1,45 @@
+#ifndef TENSOR_BUNDLE_HPP
+#define TENSOR_BUNDLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Reader for TensorFlow's tensor bundle checkpoints, i.e. the variables/
+// directory of a SavedModel: prefix.index is a LevelDB table mapping tensor
+// names to BundleEntryProtos, and the tensors themselves are raw
+// little-endian arrays in prefix.data-NNNNN-of-NNNNN. Only uncompressed
+// tables and unsliced tensors are supported, which is what TensorFlow
+// writes.
+class TensorBundle {
+public:
+  struct Entry {
+    // DataType enum value, 1 = DT_FLOAT
+    uint32_t dtype;
+    std::vector<size_t> shape;
+    uint32_t shard;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  static const uint32_t DT_FLOAT = 1;
+
+  explicit TensorBundle(const std::string &prefix);
+
+  bool has(const std::string &name) const;
+  const Entry &entry(const std::string &name) const;
+  std::vector<std::string> names() const;
+
+  // Reads a float tensor, checking that its shape matches.
+  std::vector<float> read_floats(const std::string &name,
+                                 const std::vector<size_t> &shape) const;
+
+private:
+  std::string prefix;
+  uint32_t nShards;
+  std::map<std::string, Entry> entries;
+};
+
+#endif
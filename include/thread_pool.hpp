@@ -0,0 +1,38 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+  explicit ThreadPool(size_t nThreads);
+  ~ThreadPool();
+
+  size_t size() const;
+
+  // Runs task(i) for every i in [0, nTasks) across the pool and returns once
+  // all of them have finished, so each call doubles as a barrier.
+  void run(size_t nTasks, const std::function<void(size_t)> &task);
+
+private:
+  void work();
+
+private:
+  std::vector<std::thread> threads;
+  std::mutex mutex;
+  std::condition_variable startCv;
+  std::condition_variable doneCv;
+  const std::function<void(size_t)> *task;
+  size_t nTasks;
+  size_t nextTask;
+  size_t nDone;
+  size_t generation;
+  bool stopping;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Scoped trace events, buffered per thread and written as Chrome trace JSON
+// that chrome://tracing and ui.perfetto.dev can open. Tracing is off until
+// start(); a scope that is not traced costs one relaxed atomic load.
+//
+// COARSE covers phases that run at most once per poem or growth step, FINE
+// adds the per-character passes and is much more voluminous.
+namespace trace {
+enum class Level { OFF, COARSE, FINE };
+
+extern std::atomic<int> activeLevel;
+
+inline bool enabled(Level level) {
+  return activeLevel.load(std::memory_order_relaxed) >= (int)level;
+}
+
+void start(Level level);
+void stop();
+// Stops tracing and writes every buffered event to path, returning how many
+// there were. Threads must not be inside a traced scope meanwhile.
+size_t write(const std::string &path);
+
+uint64_t now_ns();
+// name must outlive the trace, e.g. a string literal
+void record(const char *name, uint64_t beginNs, uint64_t endNs);
+
+class Scope {
+public:
+  explicit Scope(const char *name, Level level = Level::COARSE)
+      : name(enabled(level) ? name : nullptr),
+        beginNs(this->name ? now_ns() : 0) {}
+  ~Scope() {
+    if (name) {
+      record(name, beginNs, now_ns());
+    }
+  }
+
+  Scope(const Scope &) = delete;
+  Scope &operator=(const Scope &) = delete;
+
+private:
+  const char *name;
+  uint64_t beginNs;
+};
+} // namespace trace
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_FINE(name)                                                 \
+  trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name, trace::Level::FINE)
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef TRANSFORMER_MODEL_HPP
+#define TRANSFORMER_MODEL_HPP
+
+#include "alphabet.hpp"
+#include "memory_usage.hpp"
+#include "string.hpp"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// CPU inference for the character transformer trained by src/transformer.py,
+// read straight from its SavedModel variables and metadata.json. The network
+// is an embedding, a stack of AttentionPlus blocks (unmasked multi-head
+// self-attention and a ReLU dense layer, each with a residual connection and
+// a shared LayerNormalization), and a Conv1D spanning the whole window
+// followed by a dense softmax layer.
+//
+// Every position attends to every other and the head weights each position
+// separately, so sliding the window by one symbol changes every activation
+// and there is nothing to carry over between steps: probs() runs the full
+// window each time. Only the first block's query/key/value projections
+// depend on nothing but the symbol, and those are precomputed per symbol.
+class TransformerModel {
+public:
+  using State = std::vector<uint32_t>;
+  struct Workspace {
+    std::vector<uint32_t> tokens;
+    std::vector<float> x;
+    std::vector<float> qkv;
+    std::vector<float> query;
+    // transposed, keyDims x window
+    std::vector<float> key;
+    std::vector<float> value;
+    std::vector<float> scores;
+    std::vector<float> context;
+    std::vector<float> heads;
+    std::vector<float> y;
+    std::vector<float> logits;
+    std::vector<float> outLogits;
+    std::vector<double> ps;
+  };
+
+  // path is the SavedModel directory; the metadata is read from
+  // path + ".metadata.json".
+  explicit TransformerModel(const std::string &path);
+
+  State start() const;
+  State step(State state, char32_t c) const;
+  Workspace make_workspace() const;
+  const std::vector<double> &probs(const State &state,
+                                   Workspace &workspace) const;
+  double logprob(const State &state, char32_t c, Workspace &workspace) const;
+  const Alphabet<> &get_alphabet() const;
+
+  // probs() reads the whole window, and the weights never change.
+  size_t context_size() const;
+  size_t revision() const;
+
+  MemoryUsage memory_usage() const;
+
+private:
+  struct Block {
+    // query, key and value kernels side by side, dims x 3 * heads * keyDims
+    std::vector<float> qkvKernel;
+    std::vector<float> qkvBias;
+    std::vector<float> outputKernel;
+    std::vector<float> outputBias;
+    std::vector<float> gamma;
+    std::vector<float> beta;
+    std::vector<float> denseKernel;
+    std::vector<float> denseBias;
+  };
+
+  void layer_norm(float *x, const Block &block) const;
+
+private:
+  Alphabet<> alphabet;
+  // transformer symbol index of each serialized symbol
+  std::vector<uint32_t> tokenOf;
+  size_t window;
+  size_t dims;
+  size_t nHeads;
+  size_t keyDims;
+  size_t nTokens;
+  std::vector<float> embeddings;
+  // first block's query/key/value rows for each symbol's embedding
+  std::vector<float> embeddingQkv;
+  std::vector<Block> blocks;
+  std::vector<float> convKernel;
+  std::vector<float> convBias;
+  std::vector<float> outKernel;
+  std::vector<float> outBias;
+};
+
+#endif
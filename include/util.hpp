@@ -1,6 +1,40 @@
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <cstddef>
+
 double log_add_exp(double v1, double v2);
+double log2_count_slow(size_t k);
+
+// log2(k) for counts, answered from a shared table when k is small.
+const size_t LOG2_TABLE_SIZE = 1 << 12;
+const double *log2_table();
+
+inline double log2_count(size_t k) {
+  // looked up on first use rather than through a global, which could still
+  // be null when another file's static initializer gets here
+  static const double *const table = log2_table();
+  return k < LOG2_TABLE_SIZE ? table[k] : log2_count_slow(k);
+}
+
+// Log-domain kernels over contiguous arrays. All logarithms are base 2. Each
+// has a scalar and (on x86 with GCC/Clang) an AVX2 implementation, picked at
+// startup from the running CPU.
+double log_sum_exp(const double *logps, size_t n);
+void normalize_logprobs(double *logps, size_t n);
+void logprobs_to_probs(const double *logps, double *ps, size_t n);
+void log2_counts(const size_t *counts, double *out, size_t n);
+
+// Single-precision row-major matrix product on the same dispatch:
+// out (m x n) = a (m x k) * b (k x n).
+void matmul(const float *a, const float *b, float *out, size_t m, size_t k,
+            size_t n);
+
+enum class KernelIsa { SCALAR, AVX2 };
+
+KernelIsa get_kernel_isa();
+bool kernel_isa_supported(KernelIsa isa);
+void set_kernel_isa(KernelIsa isa);
+const char *kernel_isa_name(KernelIsa isa);
 
-#endif
\ No newline at end of file
+#endif
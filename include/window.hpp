@@ -0,0 +1,136 @@
+#ifndef WINDOW_HPP
+#define WINDOW_HPP
+
+#include "memory_usage.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The last few serialized symbols a model has read, oldest first, with a
+// length fixed at construction. Models with a bounded context use it as
+// their State, and step() copies one per symbol, so windows of up to
+// INLINE_LEN symbols (every n-gram order and custom net window in use) are
+// kept in the object and never touch the heap. Longer ones fall back to a
+// vector.
+class Window {
+public:
+  static const size_t INLINE_LEN = 32;
+
+  static bool fits(size_t) { return true; }
+
+  Window() : len(0), symbols{} {}
+  Window(size_t len, uint32_t symbol) : len(len), symbols{} {
+    if (len > INLINE_LEN) {
+      heap.assign(len, symbol);
+    } else {
+      std::fill_n(symbols.begin(), len, symbol);
+    }
+  }
+
+  size_t size() const { return len; }
+  bool empty() const { return !len; }
+  uint32_t *data() { return len > INLINE_LEN ? heap.data() : symbols.data(); }
+  const uint32_t *data() const {
+    return len > INLINE_LEN ? heap.data() : symbols.data();
+  }
+  uint32_t *begin() { return data(); }
+  uint32_t *end() { return data() + len; }
+  const uint32_t *begin() const { return data(); }
+  const uint32_t *end() const { return data() + len; }
+  uint32_t &operator[](size_t i) { return data()[i]; }
+  uint32_t operator[](size_t i) const { return data()[i]; }
+
+  // Drops the oldest symbol and appends symbol. An empty window stays empty.
+  void slide(uint32_t symbol) {
+    if (len) {
+      uint32_t *p = data();
+      std::copy(p + 1, p + len, p);
+      p[len - 1] = symbol;
+    }
+  }
+
+  bool operator==(const Window &other) const {
+    return std::equal(begin(), end(), other.begin(), other.end());
+  }
+  bool operator!=(const Window &other) const { return !(*this == other); }
+
+  // heap memory only; the inline symbols belong to whatever holds the window
+  Footprint footprint() const { return memory::of(heap); }
+
+private:
+  size_t len;
+  std::array<uint32_t, INLINE_LEN> symbols;
+  std::vector<uint32_t> heap;
+};
+
+// A window of exactly N symbols in a std::array, so a copy is N symbols and
+// every loop over it has a constant trip count. Same interface as Window;
+// fits() says which lengths a window type can hold.
+template <size_t N> class FixedWindow {
+public:
+  static bool fits(size_t len) { return len == N; }
+
+  FixedWindow() : symbols{} {}
+  FixedWindow(size_t len, uint32_t symbol) {
+    assert(len == N);
+    (void)len;
+    symbols.fill(symbol);
+  }
+
+  size_t size() const { return N; }
+  bool empty() const { return !N; }
+  uint32_t *data() { return symbols.data(); }
+  const uint32_t *data() const { return symbols.data(); }
+  uint32_t *begin() { return symbols.data(); }
+  uint32_t *end() { return symbols.data() + N; }
+  const uint32_t *begin() const { return symbols.data(); }
+  const uint32_t *end() const { return symbols.data() + N; }
+  uint32_t &operator[](size_t i) { return symbols[i]; }
+  uint32_t operator[](size_t i) const { return symbols[i]; }
+
+  void slide(uint32_t symbol) {
+    if (N) {
+      std::copy(symbols.begin() + 1, symbols.end(), symbols.begin());
+      symbols[N - 1] = symbol;
+    }
+  }
+
+  bool operator==(const FixedWindow &other) const {
+    return symbols == other.symbols;
+  }
+  bool operator!=(const FixedWindow &other) const { return !(*this == other); }
+
+  Footprint footprint() const { return Footprint{0, 0}; }
+
+private:
+  std::array<uint32_t, N> symbols;
+};
+
+// Calls f(FixedWindow<len>()) for the windows of n-gram orders 3 to 8, and
+// f(Window()) for any other len, and returns what f does. Callers build
+// their model inside f from the argument's type, so the length is
+// dispatched on once and never per step.
+template <class F> decltype(auto) dispatch_window(size_t len, F &&f) {
+  switch (len) {
+  case 2:
+    return f(FixedWindow<2>());
+  case 3:
+    return f(FixedWindow<3>());
+  case 4:
+    return f(FixedWindow<4>());
+  case 5:
+    return f(FixedWindow<5>());
+  case 6:
+    return f(FixedWindow<6>());
+  case 7:
+    return f(FixedWindow<7>());
+  default:
+    return f(Window());
+  }
+}
+
+#endif
@@ -0,0 +1,41 @@
+#include "alloc_counter.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef NLP_COUNT_ALLOCS
+#include <malloc.h>
+
+namespace {
+std::atomic<size_t> nAllocs(0);
+std::atomic<size_t> liveBytes(0);
+} // namespace
+
+void *operator new(size_t size) {
+  void *p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  nAllocs.fetch_add(1, std::memory_order_relaxed);
+  liveBytes.fetch_add(malloc_usable_size(p), std::memory_order_relaxed);
+  return p;
+}
+
+void operator delete(void *p) noexcept {
+  if (p) {
+    liveBytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+    std::free(p);
+  }
+}
+
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+
+bool alloc_counting_enabled() { return true; }
+size_t alloc_count() { return nAllocs.load(std::memory_order_relaxed); }
+size_t alloc_live_bytes() { return liveBytes.load(std::memory_order_relaxed); }
+#else
+bool alloc_counting_enabled() { return false; }
+size_t alloc_count() { return 0; }
+size_t alloc_live_bytes() { return 0; }
+#endif
@@ -0,0 +1,632 @@
+#include "alloc_counter.hpp"
+#include "beam_search.hpp"
+#include "bpe.hpp"
+#include "checkpoint.hpp"
+#include "corpus.hpp"
+#include "custom_net.hpp"
+#include "external_ngram.hpp"
+#include "ngram.hpp"
+#include "online_ngram.hpp"
+#include "suffix_array_model.hpp"
+#include "thread_pool.hpp"
+#include "util.hpp"
+#include "window.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Every benchmark prints one JSON object per line:
+//   {"name": ..., "iters": ..., "ns_per_op": ..., "chars_per_s": ...,
+//    "allocs_per_op": ...}
+// so runs from different commits can be diffed or loaded by a script.
+// ns_per_op is the median over REPEATS timed runs; chars_per_s is omitted
+// for benchmarks that do not process text. Accuracy checks print
+//   {"name": ..., "max_abs_err": ..., "max_rel_err": ...}
+// instead, and bench exits with status 1 if any is over its tolerance.
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+const size_t REPEATS = 5;
+// how far a log-domain kernel may stray from the code it replaced
+const double MAX_REL_ERROR = 1e-12;
+double minSeconds = 0.5;
+std::string filter;
+
+template <class T> void do_not_optimize(const T &value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+bool selected(const std::string &name) {
+  return name.find(filter) != std::string::npos;
+}
+
+// Times op() until REPEATS runs of at least minSeconds / REPEATS each have
+// been collected. charsPerOp is how many characters one call processes.
+template <class F>
+void run(const std::string &name, size_t charsPerOp, F &&op) {
+  if (!selected(name)) {
+    return;
+  }
+  op();
+
+  size_t iters = 1;
+  while (true) {
+    auto begin = Clock::now();
+    for (size_t i = 0; i < iters; i++) {
+      op();
+    }
+    double seconds =
+        std::chrono::duration<double>(Clock::now() - begin).count();
+    if (seconds >= minSeconds / REPEATS / 4 || iters >= ((size_t)1 << 30)) {
+      double perRun = minSeconds / REPEATS;
+      iters = std::max<size_t>(
+          1, (size_t)(iters * perRun / std::max(seconds, 1e-9)));
+      break;
+    }
+    iters *= 4;
+  }
+
+  std::vector<double> nsPerOp;
+  size_t allocs = alloc_count();
+  for (size_t r = 0; r < REPEATS; r++) {
+    auto begin = Clock::now();
+    for (size_t i = 0; i < iters; i++) {
+      op();
+    }
+    double ns =
+        std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+    nsPerOp.push_back(ns / iters);
+  }
+  allocs = alloc_count() - allocs;
+  std::sort(nsPerOp.begin(), nsPerOp.end());
+  double median = nsPerOp[REPEATS / 2];
+
+  std::printf("{\"name\": \"%s\", \"iters\": %zu, \"ns_per_op\": %.3f",
+              name.c_str(), iters, median);
+  if (charsPerOp) {
+    std::printf(", \"chars_per_s\": %.1f", charsPerOp * 1e9 / median);
+  }
+  std::printf(", \"allocs_per_op\": %.3f}\n",
+              (double)allocs / (iters * REPEATS));
+  std::fflush(stdout);
+}
+
+// Compares out to ref element by element and reports the largest errors.
+// Returns false if one is over MAX_REL_ERROR; the comparisons are written so
+// that a NaN counts as over.
+bool check(const std::string &name, const double *out,
+           const std::vector<double> &ref) {
+  if (!selected(name)) {
+    return true;
+  }
+  double maxAbs = 0.0, maxRel = 0.0;
+  for (size_t i = 0; i < ref.size(); i++) {
+    double err = std::abs(out[i] - ref[i]);
+    if (!(err <= maxAbs)) {
+      maxAbs = err;
+    }
+    double rel = ref[i] != 0.0 ? err / std::abs(ref[i]) : err;
+    if (!(rel <= maxRel)) {
+      maxRel = rel;
+    }
+  }
+  std::printf("{\"name\": \"%s\", \"max_abs_err\": %.3g, "
+              "\"max_rel_err\": %.3g}\n",
+              name.c_str(), maxAbs, maxRel);
+  std::fflush(stdout);
+  if (!(maxRel <= MAX_REL_ERROR)) {
+    std::cerr << name << ": error over " << MAX_REL_ERROR << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// States before each character of s, so that query benchmarks time the query
+// alone and not the State copies made by step().
+template <class M>
+std::vector<typename M::State> states(const M &model, const string32_t &s) {
+  std::vector<typename M::State> out;
+  typename M::State state = model.start();
+  for (char32_t c : s) {
+    out.push_back(state);
+    state = model.step(state, c);
+  }
+  return out;
+}
+
+size_t n_chars(const corpus_t &corpus) {
+  size_t n = 0;
+  for (const string32_t &s : corpus) {
+    n += s.size();
+  }
+  return n;
+}
+
+CustomNetModel train_custom_net(const corpus_t &corpus, size_t nPoems,
+                                const Alphabet<> &alphabet) {
+  CustomNetModel model(10, alphabet);
+  for (size_t i = 0; i < nPoems && i < corpus.size(); i++) {
+    CustomNetModel::State state = model.start();
+    for (char32_t c : corpus[i] + utf::END_STRING) {
+      model.observe(state, c);
+      state = model.step(state, c);
+    }
+  }
+  model.refresh_caches();
+  return model;
+}
+
+void bench_utf8(const std::string &bytes, const string32_t &text) {
+  run("utf8/read_utf8", text.size(), [&]() {
+    std::istringstream iss(bytes);
+    char32_t codePoint;
+    size_t n = 0;
+    while ((codePoint = utf::read_utf8(iss)) != utf::END_STREAM) {
+      n += codePoint;
+    }
+    do_not_optimize(n);
+  });
+  std::ostringstream oss;
+  run("utf8/write_utf8", text.size(), [&]() {
+    oss.seekp(0);
+    for (char32_t c : text) {
+      utf::write_utf8(c, oss);
+    }
+    do_not_optimize(oss.tellp());
+  });
+  run("utf8/utf8_writer", text.size(), [&]() {
+    oss.seekp(0);
+    utf::Utf8Writer(oss).write(text);
+    do_not_optimize(oss.tellp());
+  });
+}
+
+void bench_alphabet(const Alphabet<> &alphabet, const string32_t &text) {
+  std::vector<uint32_t> serial(text.size());
+  run("alphabet/serialize", text.size(), [&]() {
+    for (size_t i = 0; i < text.size(); i++) {
+      serial[i] = alphabet.serialize(text[i]);
+    }
+    do_not_optimize(serial.data());
+  });
+  string32_t out(text.size(), 0);
+  run("alphabet/deserialize", text.size(), [&]() {
+    for (size_t i = 0; i < serial.size(); i++) {
+      out[i] = alphabet.deserialize(serial[i]);
+    }
+    do_not_optimize(out.data());
+  });
+}
+
+// What the state of a model with N symbols of context costs per character:
+// step() copies it and slides in the new symbol, and a query walks it. Window
+// is the state for any N; FixedWindow<N> is what dispatch_window() picks for
+// the n-gram orders it specializes.
+template <size_t N>
+void bench_window(const Alphabet<> &alphabet, const string32_t &s) {
+  std::vector<uint32_t> symbols(s.size());
+  for (size_t i = 0; i < s.size(); i++) {
+    symbols[i] = alphabet.serialize(s[i]);
+  }
+  run("window/step/" + std::to_string(N), s.size(), [&]() {
+    Window state(N, 0);
+    uint32_t hash = 0;
+    for (uint32_t symbol : symbols) {
+      Window next = state;
+      next.slide(symbol);
+      state = next;
+      for (uint32_t x : state) {
+        hash = hash * 31 + x;
+      }
+    }
+    do_not_optimize(hash);
+  });
+  run("window/step_fixed/" + std::to_string(N), s.size(), [&]() {
+    FixedWindow<N> state(N, 0);
+    uint32_t hash = 0;
+    for (uint32_t symbol : symbols) {
+      FixedWindow<N> next = state;
+      next.slide(symbol);
+      state = next;
+      for (uint32_t x : state) {
+        hash = hash * 31 + x;
+      }
+    }
+    do_not_optimize(hash);
+  });
+}
+
+// Checks each kernel against the loops it replaced, a log_add_exp() fold and
+// std::log2() per count, and times it. Returns false if a check failed.
+bool bench_log(size_t alphabetSize) {
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<double> dist(-30.0, 0.0);
+  std::vector<double> logps(alphabetSize);
+  for (double &logp : logps) {
+    logp = dist(gen);
+  }
+
+  run("util/log_add_exp", 0, [&]() {
+    double acc = logps[0];
+    for (size_t i = 1; i < logps.size(); i++) {
+      acc = log_add_exp(acc, logps[i]);
+    }
+    do_not_optimize(acc);
+  });
+
+  std::vector<double> scratch(alphabetSize);
+  std::vector<size_t> counts(alphabetSize);
+  for (size_t i = 0; i < counts.size(); i++) {
+    counts[i] = 1 + (gen() % 100000);
+  }
+  // the transformer's query/key/value projection of a 128-symbol window
+  std::vector<float> a(128 * 64), b(64 * 768), product(128 * 768);
+  for (float &x : a) {
+    x = (float)dist(gen);
+  }
+  for (float &x : b) {
+    x = (float)dist(gen);
+  }
+
+  std::vector<double> refLogSumExp(1, logps[0]);
+  for (size_t i = 1; i < logps.size(); i++) {
+    refLogSumExp[0] = log_add_exp(refLogSumExp[0], logps[i]);
+  }
+  std::vector<double> refNormalized(alphabetSize), refProbs(alphabetSize),
+      refLog2Counts(alphabetSize);
+  for (size_t i = 0; i < alphabetSize; i++) {
+    refNormalized[i] = logps[i] - refLogSumExp[0];
+    refProbs[i] = std::exp2(refNormalized[i]);
+    refLog2Counts[i] = std::log2((double)counts[i]);
+  }
+
+  bool accurate = true;
+  KernelIsa initial = get_kernel_isa();
+  for (KernelIsa isa : {KernelIsa::SCALAR, KernelIsa::AVX2}) {
+    if (!kernel_isa_supported(isa)) {
+      continue;
+    }
+    set_kernel_isa(isa);
+    std::string suffix = std::string("/") + kernel_isa_name(isa);
+    double sum = log_sum_exp(logps.data(), logps.size());
+    accurate &= check("util/log_sum_exp" + suffix, &sum, refLogSumExp);
+    std::copy(logps.begin(), logps.end(), scratch.begin());
+    normalize_logprobs(scratch.data(), scratch.size());
+    accurate &= check("util/normalize_logprobs" + suffix, scratch.data(),
+                      refNormalized);
+    logprobs_to_probs(logps.data(), scratch.data(), logps.size());
+    accurate &=
+        check("util/logprobs_to_probs" + suffix, scratch.data(), refProbs);
+    log2_counts(counts.data(), scratch.data(), counts.size());
+    accurate &=
+        check("util/log2_counts" + suffix, scratch.data(), refLog2Counts);
+
+    run("util/log_sum_exp" + suffix, 0, [&]() {
+      do_not_optimize(log_sum_exp(logps.data(), logps.size()));
+    });
+    run("util/normalize_logprobs" + suffix, 0, [&]() {
+      std::copy(logps.begin(), logps.end(), scratch.begin());
+      normalize_logprobs(scratch.data(), scratch.size());
+      do_not_optimize(scratch.data());
+    });
+    run("util/logprobs_to_probs" + suffix, 0, [&]() {
+      logprobs_to_probs(logps.data(), scratch.data(), logps.size());
+      do_not_optimize(scratch.data());
+    });
+    run("util/log2_counts" + suffix, 0, [&]() {
+      log2_counts(counts.data(), scratch.data(), counts.size());
+      do_not_optimize(scratch.data());
+    });
+    run("util/matmul_128x64x768" + suffix, 0, [&]() {
+      matmul(a.data(), b.data(), product.data(), 128, 64, 768);
+      do_not_optimize(product.data());
+    });
+  }
+  set_kernel_isa(initial);
+  return accurate;
+}
+
+void bench_ngram(const corpus_t &trainCorpus, const corpus_t &valCorpus,
+                 const Alphabet<> &alphabet) {
+  NGramModel model(5, alphabet);
+  size_t nTrainChars = n_chars(trainCorpus) + trainCorpus.size();
+  run("ngram/observe", nTrainChars, [&]() {
+    dispatch_window(4, [&](auto empty) {
+      using W = decltype(empty);
+      for (const string32_t &s : trainCorpus) {
+        W window = model.start_window<W>();
+        for (char32_t c : s + utf::END_STRING) {
+          model.observe(window, c);
+          window = model.slide(window, c);
+        }
+      }
+    });
+  });
+  model.link();
+
+  const string32_t &s = valCorpus[0];
+  run("ngram/step", s.size(), [&]() {
+    NGramModel::State state = model.start();
+    for (char32_t c : s) {
+      state = model.step(state, c);
+    }
+    do_not_optimize(state[0]);
+  });
+
+  NGramModel::Workspace workspace = model.make_workspace();
+  std::vector<NGramModel::State> queries = states(model, s);
+  run("ngram/probs", queries.size(), [&]() {
+    for (const NGramModel::State &state : queries) {
+      do_not_optimize(model.probs(state, workspace).data());
+    }
+  });
+}
+
+// Counts through run files with a budget that forces several runs, and
+// queries the result in place.
+void bench_external_ngram(const corpus_t &trainCorpus,
+                          const corpus_t &valCorpus,
+                          const Alphabet<> &alphabet) {
+  const std::string path = "bench_ngram.tmp";
+  size_t nTrainChars = n_chars(trainCorpus) + trainCorpus.size();
+  auto count = [&]() {
+    ExternalNGramCounter<FixedWindow<4>> counter(5, alphabet, path, 8 << 20);
+    for (const string32_t &s : trainCorpus) {
+      FixedWindow<4> state = counter.start();
+      for (char32_t c : s + utf::END_STRING) {
+        counter.observe(state, c);
+        state = counter.step(state, c);
+      }
+    }
+    return counter.write();
+  };
+  run("external_ngram/count", nTrainChars,
+      [&]() { do_not_optimize(count()); });
+
+  if (selected("external_ngram/probs")) {
+    // the queries need the file that counting writes
+    if (!selected("external_ngram/count")) {
+      count();
+    }
+    DiskNGramModel<FixedWindow<4>> model(path);
+    auto workspace = model.make_workspace();
+    std::vector<FixedWindow<4>> queries = states(model, valCorpus[0]);
+    run("external_ngram/probs", queries.size(), [&]() {
+      for (const FixedWindow<4> &state : queries) {
+        do_not_optimize(model.probs(state, workspace).data());
+      }
+    });
+  }
+  std::remove(path.c_str());
+}
+
+void bench_suffix_array(const corpus_t &trainCorpus, const corpus_t &valCorpus,
+                        const Alphabet<> &alphabet) {
+  size_t nTrainChars = n_chars(trainCorpus) + 2 * trainCorpus.size();
+  run("suffix_array/build", nTrainChars, [&]() {
+    do_not_optimize(SuffixArrayModel(trainCorpus, alphabet).size());
+  });
+
+  SuffixArrayModel model(trainCorpus, alphabet);
+  const string32_t &s = valCorpus[0];
+  run("suffix_array/step", s.size(), [&]() {
+    SuffixArrayModel::State state = model.start();
+    for (char32_t c : s) {
+      state = model.step(state, c);
+    }
+    do_not_optimize(state[SuffixArrayModel::DEPTH]);
+  });
+
+  SuffixArrayModel::Workspace workspace = model.make_workspace();
+  std::vector<SuffixArrayModel::State> queries = states(model, s);
+  run("suffix_array/probs", queries.size(), [&]() {
+    for (const SuffixArrayModel::State &state : queries) {
+      do_not_optimize(model.probs(state, workspace).data());
+    }
+  });
+}
+
+void bench_bpe(const corpus_t &trainCorpus, const corpus_t &valCorpus) {
+  run("bpe/train", n_chars(trainCorpus), [&]() {
+    do_not_optimize(BpeTokenizer(trainCorpus, 1000).n_merges());
+  });
+
+  BpeTokenizer tokenizer(trainCorpus, 1000);
+  run("bpe/encode", n_chars(valCorpus), [&]() {
+    do_not_optimize(tokenizer.encode(valCorpus).size());
+  });
+}
+
+// Scores valCorpus[0] with a model trained on the first nPoems poems, and
+// times checkpointing that model.
+void bench_custom_net(const corpus_t &trainCorpus, const corpus_t &valCorpus,
+                      const Alphabet<> &alphabet, size_t nPoems) {
+  CustomNetModel model = train_custom_net(trainCorpus, nPoems, alphabet);
+  std::string size = "/" + std::to_string(model.n_combos()) + "combos";
+
+  // Replicas observe without growing the graph, so its size stays fixed.
+  CustomNetModel::Replica replica = model.make_replica();
+  const string32_t &train = trainCorpus[0];
+  run("custom_net/observe" + size, train.size() + 1, [&]() {
+    CustomNetModel::State state = model.start();
+    for (char32_t c : train + utf::END_STRING) {
+      model.observe(replica, state, c);
+      state = model.step(state, c);
+    }
+  });
+
+  CustomNetModel::Workspace workspace = model.make_workspace();
+  std::vector<CustomNetModel::State> queries = states(model, valCorpus[0]);
+  run("custom_net/probs" + size, queries.size(), [&]() {
+    for (const CustomNetModel::State &state : queries) {
+      do_not_optimize(model.probs(state, workspace).data());
+    }
+  });
+
+  const std::string path = "bench.ckpt";
+  Checkpoint checkpoint = model.checkpoint();
+  run("checkpoint/write" + size, 0,
+      [&]() { do_not_optimize(write_checkpoint(checkpoint, path)); });
+  run("checkpoint/read" + size, 0, [&]() {
+    Checkpoint loaded = read_checkpoint(path);
+    do_not_optimize(loaded.combos.data());
+  });
+  run("checkpoint/load_model" + size, 0, [&]() {
+    CustomNetModel loaded(read_checkpoint(path));
+    do_not_optimize(loaded.n_combos());
+  });
+  std::remove(path.c_str());
+}
+
+// Scores the first nPoems validation poems on nThreads threads, one workspace
+// per task, the way perplexity() in main does.
+void bench_scoring(const corpus_t &trainCorpus, const corpus_t &allValCorpus,
+                   const Alphabet<> &alphabet, size_t nPoems) {
+  corpus_t valCorpus(allValCorpus.begin(),
+                     allValCorpus.begin() +
+                         std::min(nPoems, allValCorpus.size()));
+  CustomNetModel model = train_custom_net(trainCorpus, trainCorpus.size(),
+                                          alphabet);
+  size_t nChars = n_chars(valCorpus);
+  size_t maxThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  for (size_t nThreads = 1; nThreads <= maxThreads; nThreads *= 2) {
+    ThreadPool pool(nThreads);
+    std::vector<CustomNetModel::Workspace> workspaces(
+        nThreads, model.make_workspace());
+    run("custom_net/score_threads/" + std::to_string(nThreads), nChars, [&]() {
+      std::atomic<size_t> next(0);
+      pool.run(nThreads, [&](size_t t) {
+        double loglh = 0;
+        for (size_t i; (i = next.fetch_add(1)) < valCorpus.size();) {
+          CustomNetModel::State state = model.start();
+          for (char32_t c : valCorpus[i]) {
+            loglh += model.logprob(state, c, workspaces[t]);
+            state = model.step(state, c);
+          }
+        }
+        do_not_optimize(loglh);
+      });
+    });
+  }
+}
+
+// Decoding latency against beam width, expanding each step across all
+// hardware threads.
+void bench_beam(const corpus_t &trainCorpus, const Alphabet<> &alphabet) {
+  CustomNetModel model = train_custom_net(trainCorpus, trainCorpus.size(),
+                                          alphabet);
+  size_t nThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+  ThreadPool pool(nThreads);
+  for (size_t width : {1, 2, 4, 8, 16}) {
+    run("custom_net/beam/" + std::to_string(width), 0, [&]() {
+      do_not_optimize(
+          beam_search((const CustomNetModel &)model, 200, width, 0.6,
+                      nThreads > 1 ? &pool : nullptr)
+              .size());
+    });
+  }
+}
+
+// Times reader queries while another thread keeps ingesting and publishing.
+// The allocation count includes the writer's, since the counter is global.
+void bench_online(const corpus_t &trainCorpus, const corpus_t &valCorpus,
+                  const Alphabet<> &alphabet) {
+  OnlineNGramModel model(5, alphabet, 10000);
+  std::atomic<bool> ingesting(true);
+  std::thread writer([&]() {
+    for (size_t i = 0; ingesting.load(); i++) {
+      const string32_t &s = trainCorpus[i % trainCorpus.size()];
+      OnlineNGramModel::State state = model.start();
+      for (char32_t c : s + utf::END_STRING) {
+        model.observe(state, c);
+        state = model.step(state, c);
+      }
+    }
+  });
+
+  OnlineNGramModel::Reader reader(model);
+  OnlineNGramModel::Workspace workspace = model.make_workspace();
+  const string32_t &s = valCorpus[0];
+  std::vector<OnlineNGramModel::State> queries = states(model, s);
+  run("online_ngram/logprob_under_ingest", s.size(), [&]() {
+    double loglh = 0;
+    for (size_t i = 0; i < s.size(); i++) {
+      loglh += reader.logprob(queries[i], s[i], workspace);
+    }
+    do_not_optimize(loglh);
+  });
+  ingesting.store(false);
+  writer.join();
+}
+} // namespace
+
+int main(int argc, char *argv[]) {
+  std::string trainPath = "data/train-mini.txt";
+  std::string valPath = "data/validate.txt";
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--filter" && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (arg == "--min-time" && i + 1 < argc) {
+      minSeconds = std::stod(argv[++i]);
+    } else if (arg == "--train" && i + 1 < argc) {
+      trainPath = argv[++i];
+    } else if (arg == "--validate" && i + 1 < argc) {
+      valPath = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--filter substring] [--min-time seconds]"
+                << " [--train path] [--validate path]" << std::endl;
+      return 1;
+    }
+  }
+
+  corpus_t trainCorpus = load_corpus(trainPath);
+  corpus_t valCorpus = load_corpus(valPath);
+  Alphabet<> alphabet = get_corpus_alphabet(trainCorpus);
+
+  run("corpus/load_corpus", n_chars(trainCorpus),
+      [&]() { do_not_optimize(load_corpus(trainPath).size()); });
+
+  string32_t text;
+  for (const string32_t &s : trainCorpus) {
+    text += s;
+  }
+  std::string bytes;
+  {
+    std::ostringstream oss;
+    for (char32_t c : text) {
+      utf::write_utf8(c, oss);
+    }
+    bytes = oss.str();
+  }
+  bench_utf8(bytes, text);
+  bench_alphabet(alphabet, text);
+  // n-grams of order 5 and 8, and custom net windows of 16 and 32
+  bench_window<4>(alphabet, valCorpus[0]);
+  bench_window<7>(alphabet, valCorpus[0]);
+  bench_window<15>(alphabet, valCorpus[0]);
+  bench_window<31>(alphabet, valCorpus[0]);
+  bool accurate = bench_log(alphabet.size());
+  bench_ngram(trainCorpus, valCorpus, alphabet);
+  bench_external_ngram(trainCorpus, valCorpus, alphabet);
+  bench_suffix_array(trainCorpus, valCorpus, alphabet);
+  bench_bpe(trainCorpus, valCorpus);
+  for (size_t nPoems : {(size_t)10, (size_t)40, trainCorpus.size()}) {
+    bench_custom_net(trainCorpus, valCorpus, alphabet, nPoems);
+  }
+  bench_scoring(trainCorpus, valCorpus, alphabet, 20);
+  bench_beam(trainCorpus, alphabet);
+  bench_online(trainCorpus, valCorpus, alphabet);
+  return accurate ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+#include "bpe.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <limits>
+#include <queue>
+
+namespace {
+// ASCII letters, digits and apostrophes, and everything outside ASCII
+bool is_word(char32_t c) {
+  return c < 128 ? std::isalnum((int)c) || c == U'\'' : true;
+}
+} // namespace
+
+BpeTokenizer::BpeTokenizer(const corpus_t &corpus, size_t nMerges) {
+  TRACE_SCOPE("train_bpe");
+  struct Word {
+    string32_t chunk;
+    string32_t symbols;
+    size_t count;
+  };
+  std::vector<Word> words;
+  {
+    std::unordered_map<string32_t, size_t> counts;
+    for (const string32_t &s : corpus) {
+      for (const string32_t &chunk : chunks(s)) {
+        counts[chunk]++;
+      }
+    }
+    for (const auto &entry : counts) {
+      words.push_back(Word{entry.first, entry.first, entry.second});
+    }
+    // hash order is not portable, and ties must break the same everywhere
+    std::sort(words.begin(), words.end(),
+              [](const Word &a, const Word &b) { return a.chunk < b.chunk; });
+  }
+
+  // how often each adjacent pair occurs, and the words it may occur in
+  std::unordered_map<uint64_t, size_t> pairCounts;
+  std::unordered_map<uint64_t, std::vector<uint32_t>> pairWords;
+  for (uint32_t id = 0; id < words.size(); id++) {
+    const string32_t &symbols = words[id].symbols;
+    for (size_t i = 0; i + 1 < symbols.size(); i++) {
+      uint64_t key = pair_key(symbols[i], symbols[i + 1]);
+      pairCounts[key] += words[id].count;
+      pairWords[key].push_back(id);
+    }
+  }
+  // most frequent first, then the smaller pair; entries whose count is out of
+  // date are skipped when they come up
+  using Entry = std::pair<size_t, uint64_t>;
+  auto lower = [](const Entry &a, const Entry &b) {
+    return a.first < b.first || (a.first == b.first && a.second > b.second);
+  };
+  std::priority_queue<Entry, std::vector<Entry>, decltype(lower)> heap(lower);
+  for (const auto &entry : pairCounts) {
+    heap.emplace(entry.second, entry.first);
+  }
+
+  std::vector<size_t> lastMerge(words.size(),
+                                std::numeric_limits<size_t>::max());
+  std::vector<uint64_t> changed;
+  while (merges.size() < nMerges && !heap.empty()) {
+    const Entry top = heap.top();
+    heap.pop();
+    auto found = pairCounts.find(top.second);
+    if (found == pairCounts.end() || found->second != top.first) {
+      continue;
+    }
+    if (top.first < 2) {
+      break;
+    }
+    const char32_t left = (char32_t)(top.second >> 32);
+    const char32_t right = (char32_t)top.second;
+    const char32_t token = FIRST_TOKEN + (char32_t)merges.size();
+    ranks.emplace(top.second, (uint32_t)merges.size());
+    merges.emplace_back(left, right);
+    expansions.push_back(expand(left) + expand(right));
+
+    // Rewrite every word that has the pair, moving the counts of its old
+    // pairs to its new ones.
+    std::vector<uint32_t> ids = std::move(pairWords[top.second]);
+    changed.clear();
+    for (uint32_t id : ids) {
+      if (lastMerge[id] == merges.size()) {
+        continue;
+      }
+      lastMerge[id] = merges.size();
+      Word &word = words[id];
+      string32_t merged;
+      for (size_t i = 0; i < word.symbols.size();) {
+        if (i + 1 < word.symbols.size() && word.symbols[i] == left &&
+            word.symbols[i + 1] == right) {
+          merged.push_back(token);
+          i += 2;
+        } else {
+          merged.push_back(word.symbols[i++]);
+        }
+      }
+      if (merged.size() == word.symbols.size()) {
+        continue;
+      }
+      for (size_t i = 0; i + 1 < word.symbols.size(); i++) {
+        uint64_t key = pair_key(word.symbols[i], word.symbols[i + 1]);
+        pairCounts[key] -= word.count;
+        changed.push_back(key);
+      }
+      for (size_t i = 0; i + 1 < merged.size(); i++) {
+        uint64_t key = pair_key(merged[i], merged[i + 1]);
+        pairCounts[key] += word.count;
+        changed.push_back(key);
+        if (merged[i] == token || merged[i + 1] == token) {
+          pairWords[key].push_back(id);
+        }
+      }
+      word.symbols = std::move(merged);
+    }
+    std::sort(changed.begin(), changed.end());
+    changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+    for (uint64_t key : changed) {
+      auto count = pairCounts.find(key);
+      if (!count->second) {
+        pairCounts.erase(count);
+        pairWords.erase(key);
+      } else {
+        heap.emplace(count->second, key);
+      }
+    }
+  }
+
+  for (Word &word : words) {
+    known.emplace(std::move(word.chunk), std::move(word.symbols));
+  }
+}
+
+string32_t BpeTokenizer::encode(const string32_t &s) const {
+  string32_t out;
+  for (const string32_t &chunk : chunks(s)) {
+    out += encode_chunk(chunk);
+  }
+  return out;
+}
+
+corpus_t BpeTokenizer::encode(const corpus_t &corpus) const {
+  corpus_t out;
+  out.reserve(corpus.size());
+  for (const string32_t &s : corpus) {
+    out.push_back(encode(s));
+  }
+  return out;
+}
+
+string32_t BpeTokenizer::decode(const string32_t &tokens) const {
+  string32_t out;
+  for (char32_t token : tokens) {
+    out += expand(token);
+  }
+  return out;
+}
+
+string32_t BpeTokenizer::expand(char32_t token) const {
+  if (token >= FIRST_TOKEN && token - FIRST_TOKEN < expansions.size()) {
+    return expansions[token - FIRST_TOKEN];
+  }
+  return string32_t(1, token);
+}
+
+size_t BpeTokenizer::n_merges() const { return merges.size(); }
+
+uint64_t BpeTokenizer::pair_key(char32_t left, char32_t right) {
+  return (uint64_t)left << 32 | right;
+}
+
+std::vector<string32_t> BpeTokenizer::chunks(const string32_t &s) {
+  std::vector<string32_t> out;
+  for (size_t i = 0; i < s.size();) {
+    size_t begin = i;
+    if (s[i] == U' ' && i + 1 < s.size() && is_word(s[i + 1])) {
+      i++;
+    }
+    if (is_word(s[i])) {
+      while (i < s.size() && is_word(s[i])) {
+        i++;
+      }
+    } else {
+      i++;
+    }
+    out.push_back(s.substr(begin, i - begin));
+  }
+  return out;
+}
+
+string32_t BpeTokenizer::encode_chunk(const string32_t &chunk) const {
+  auto found = known.find(chunk);
+  if (found != known.end()) {
+    return found->second;
+  }
+  string32_t symbols = chunk;
+  while (symbols.size() > 1) {
+    uint32_t best = std::numeric_limits<uint32_t>::max();
+    for (size_t i = 0; i + 1 < symbols.size(); i++) {
+      auto rank = ranks.find(pair_key(symbols[i], symbols[i + 1]));
+      if (rank != ranks.end()) {
+        best = std::min(best, rank->second);
+      }
+    }
+    if (best == std::numeric_limits<uint32_t>::max()) {
+      break;
+    }
+    const char32_t left = merges[best].first;
+    const char32_t right = merges[best].second;
+    string32_t merged;
+    for (size_t i = 0; i < symbols.size();) {
+      if (i + 1 < symbols.size() && symbols[i] == left &&
+          symbols[i + 1] == right) {
+        merged.push_back(FIRST_TOKEN + best);
+        i += 2;
+      } else {
+        merged.push_back(symbols[i++]);
+      }
+    }
+    symbols = std::move(merged);
+  }
+  return symbols;
+}
+
+MemoryUsage BpeTokenizer::memory_usage() const {
+  MemoryUsage usage;
+  usage.add("merges", memory::of(merges));
+  usage.add("expansions", memory::of(expansions));
+  for (const string32_t &expansion : expansions) {
+    usage.add("expansions.text", memory::of(expansion));
+  }
+  usage.add("ranks", memory::of(ranks));
+  usage.add("known", memory::of(known));
+  for (const auto &entry : known) {
+    usage.add("known.text", memory::of(entry.first));
+    usage.add("known.text", memory::of(entry.second));
+  }
+  return usage;
+}
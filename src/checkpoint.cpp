@@ -0,0 +1,164 @@
+#include "checkpoint.hpp"
+#include "trace.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+const char MAGIC[8] = {'N', 'L', 'P', 'C', 'K', 'P', 'T', '\0'};
+const uint32_t FORMAT_VERSION = 1;
+
+template <class T> void write_pod(std::ofstream &ofs, const T &value) {
+  ofs.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <class T>
+void write_vector(std::ofstream &ofs, const std::vector<T> &values) {
+  write_pod<uint64_t>(ofs, values.size());
+  ofs.write(reinterpret_cast<const char *>(values.data()),
+            values.size() * sizeof(T));
+}
+
+template <class T> T read_pod(std::ifstream &ifs) {
+  T value;
+  if (!ifs.read(reinterpret_cast<char *>(&value), sizeof(T))) {
+    throw std::runtime_error("checkpoint: unexpected end of file");
+  }
+  return value;
+}
+
+template <class T>
+std::vector<T> read_vector(std::ifstream &ifs, uint64_t maxSize) {
+  uint64_t size = read_pod<uint64_t>(ifs);
+  if (size > maxSize) {
+    throw std::runtime_error("checkpoint: corrupt array length");
+  }
+  std::vector<T> values(size);
+  if (!ifs.read(reinterpret_cast<char *>(values.data()), size * sizeof(T))) {
+    throw std::runtime_error("checkpoint: unexpected end of file");
+  }
+  return values;
+}
+} // namespace
+
+size_t write_checkpoint(const Checkpoint &checkpoint, const std::string &path) {
+  TRACE_SCOPE("write_checkpoint");
+  const std::string tmpPath = path + ".tmp";
+  {
+    std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!ofs.is_open()) {
+      throw std::runtime_error("checkpoint: cannot open " + tmpPath);
+    }
+    ofs.write(MAGIC, sizeof(MAGIC));
+    write_pod(ofs, FORMAT_VERSION);
+    write_pod(ofs, checkpoint.windowLen);
+    write_pod(ofs, checkpoint.nObserved);
+    write_vector(ofs, checkpoint.alphabet);
+    write_vector(ofs, checkpoint.inputXs);
+    write_vector(ofs, checkpoint.inputNs);
+    write_vector(ofs, checkpoint.combos);
+    write_vector(ofs, checkpoint.slots);
+    write_vector(ofs, checkpoint.cursor);
+    ofs.flush();
+    if (!ofs) {
+      throw std::runtime_error("checkpoint: write to " + tmpPath + " failed");
+    }
+  }
+  if (std::rename(tmpPath.c_str(), path.c_str())) {
+    throw std::runtime_error("checkpoint: cannot rename to " + path);
+  }
+  std::ifstream written(path, std::ios::binary | std::ios::ate);
+  return (size_t)written.tellg();
+}
+
+Checkpoint read_checkpoint(const std::string &path) {
+  TRACE_SCOPE("read_checkpoint");
+  std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+  if (!ifs.is_open()) {
+    throw std::runtime_error("checkpoint: cannot open " + path);
+  }
+  // no array can hold more elements than the file has bytes
+  const uint64_t fileSize = (uint64_t)ifs.tellg();
+  ifs.seekg(0);
+
+  char magic[sizeof(MAGIC)];
+  if (!ifs.read(magic, sizeof(magic)) ||
+      std::memcmp(magic, MAGIC, sizeof(MAGIC))) {
+    throw std::runtime_error("checkpoint: " + path + " is not a checkpoint");
+  }
+  if (read_pod<uint32_t>(ifs) != FORMAT_VERSION) {
+    throw std::runtime_error("checkpoint: unsupported format version");
+  }
+
+  Checkpoint checkpoint;
+  checkpoint.windowLen = read_pod<uint64_t>(ifs);
+  checkpoint.nObserved = read_pod<uint64_t>(ifs);
+  checkpoint.alphabet = read_vector<char32_t>(ifs, fileSize);
+  checkpoint.inputXs = read_vector<uint64_t>(ifs, fileSize);
+  checkpoint.inputNs = read_vector<uint64_t>(ifs, fileSize);
+  checkpoint.combos = read_vector<Checkpoint::Combo>(ifs, fileSize);
+  checkpoint.slots = read_vector<Checkpoint::Slot>(ifs, fileSize);
+  checkpoint.cursor = read_vector<uint64_t>(ifs, fileSize);
+
+  if (checkpoint.inputNs.size() != checkpoint.windowLen ||
+      checkpoint.inputXs.size() !=
+          checkpoint.windowLen * checkpoint.alphabet.size()) {
+    throw std::runtime_error("checkpoint: input counts do not match window");
+  }
+  // a slot may only refer to nodes before nNodes, and bit indices must exist
+  auto valid = [&](const Checkpoint::Slot &slot, uint64_t nNodes) {
+    auto validBit = [&](uint64_t node, uint64_t index) {
+      return node < nNodes && (node < checkpoint.windowLen
+                                   ? index < checkpoint.alphabet.size()
+                                   : index == 0);
+    };
+    return validBit(slot.node1, slot.index1) &&
+           validBit(slot.node2, slot.index2) && slot.node1 != slot.node2;
+  };
+  for (size_t i = 0; i < checkpoint.combos.size(); i++) {
+    if (!valid(checkpoint.combos[i].slot, checkpoint.windowLen + i)) {
+      throw std::runtime_error("checkpoint: malformed combo");
+    }
+  }
+  for (const Checkpoint::Slot &slot : checkpoint.slots) {
+    if (!valid(slot, checkpoint.windowLen + checkpoint.combos.size())) {
+      throw std::runtime_error("checkpoint: malformed slot");
+    }
+  }
+  return checkpoint;
+}
+
+CheckpointWriter::CheckpointWriter()
+    : pending(), lastBytes(0), lastSeconds(0.0) {}
+
+CheckpointWriter::~CheckpointWriter() {
+  if (pending.valid()) {
+    pending.wait();
+  }
+}
+
+void CheckpointWriter::write(Checkpoint checkpoint, const std::string &path) {
+  wait();
+  pending = std::async(std::launch::async,
+                       [this, checkpoint = std::move(checkpoint), path]() {
+                         auto begin = std::chrono::steady_clock::now();
+                         lastBytes = write_checkpoint(checkpoint, path);
+                         lastSeconds = std::chrono::duration<double>(
+                                           std::chrono::steady_clock::now() -
+                                           begin)
+                                           .count();
+                       });
+}
+
+void CheckpointWriter::wait() {
+  if (pending.valid()) {
+    pending.get();
+  }
+}
+
+size_t CheckpointWriter::last_bytes() const { return lastBytes; }
+
+double CheckpointWriter::last_seconds() const { return lastSeconds; }
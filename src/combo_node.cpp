@@ -3,91 +3,129 @@
 
 #include <algorithm>
 #include <cassert>
-
-std::vector<double> &normalize_logprobs(std::vector<double> &logps) {
-  std::vector<double> ps(logps.size());
-  double winner = *std::max_element(logps.begin(), logps.end());
-  double total = 0.0;
-  for (size_t i = 0; i < logps.size(); i++) {
-    ps[i] = std::exp2(logps[i] - winner);
-    total += ps[i];
-  }
-  for (size_t i = 0; i < logps.size(); i++) {
-    logps[i] = std::log2(ps[i]) - std::log2(total);
-  }
-  return logps;
-}
+#include <cmath>
+#include <limits>
 
 ComboNode::ComboNode(Node &node1, size_t index1, Node &node2, size_t index2)
     : Node(std::max(node1.get_level(), node2.get_level()) + 1, 2, 4),
       node1(node1), node2(node2), index1(index1),
-      index2(index2), xs{1, 1, 1, 1}, n(4) {}
+      index2(index2), xs{1, 1, 1, 1}, n(4), logPs{0.0, 0.0, 0.0, 0.0},
+      dirty(true), mutualInfo(0.0), infoDirty(true) {}
 
 double ComboNode::mutual_info() const {
-  double info = 0.0;
-  const double logN = std::log2(n);
+  if (!infoDirty) {
+    return mutualInfo;
+  }
+  mutualInfo = mutual_info(counts());
+  infoDirty = false;
+  return mutualInfo;
+}
+
+double ComboNode::mutual_info(const std::array<size_t, 4> &xs) {
+  const size_t n = xs[0] + xs[1] + xs[2] + xs[3];
+  const double logN = log2_count(n);
+  double mutualInfo = 0.0;
   for (bool bit1 : {true, false}) {
     const double logp1 =
-        std::log2(xs[xs_index(bit1, true)] + xs[xs_index(bit1, false)]) - logN;
+        log2_count(xs[xs_index(bit1, true)] + xs[xs_index(bit1, false)]) -
+        logN;
     for (bool bit2 : {true, false}) {
       const double logp2 =
-          std::log2(xs[xs_index(true, bit2)] + xs[xs_index(false, bit2)]) -
+          log2_count(xs[xs_index(true, bit2)] + xs[xs_index(false, bit2)]) -
           logN;
       const size_t x = xs[xs_index(bit1, bit2)];
       const double probJoint = (double)x / (double)n;
-      const double logpJoint = std::log2(x) - std::log2(n);
-      info += probJoint * (logpJoint - (logp1 + logp2));
+      const double logpJoint = log2_count(x) - logN;
+      mutualInfo += probJoint * (logpJoint - (logp1 + logp2));
     }
   }
-  return info;
+  return mutualInfo;
 }
 
 Node &ComboNode::get_node1() { return node1; }
 
 Node &ComboNode::get_node2() { return node2; }
 
-void ComboNode::observe() {
-  const bool bit1 = node1.get_forward_bit(index1);
-  const bool bit2 = node2.get_forward_bit(index2);
+const Node &ComboNode::get_node1() const { return node1; }
+
+const Node &ComboNode::get_node2() const { return node2; }
+
+size_t ComboNode::get_index1() const { return index1; }
+
+size_t ComboNode::get_index2() const { return index2; }
+
+size_t ComboNode::n_observed() const { return n; }
+
+void ComboNode::add_counts(const std::array<size_t, 4> &delta) {
+  for (size_t i = 0; i < 4; i++) {
+    xs[i] += delta[i];
+    n += delta[i];
+  }
+  dirty = true;
+  infoDirty = true;
+}
+
+std::array<size_t, 4> ComboNode::counts() const {
+  return {xs[0], xs[1], xs[2], xs[3]};
+}
+
+void ComboNode::set_counts(const std::array<size_t, 4> &xs) {
+  n = 0;
+  for (size_t i = 0; i < 4; i++) {
+    this->xs[i] = xs[i];
+    n += xs[i];
+  }
+  dirty = true;
+  infoDirty = true;
+}
+
+void ComboNode::observe(const Activation &activation) {
+  const bool bit1 = node1.get_forward_bit(activation, index1);
+  const bool bit2 = node2.get_forward_bit(activation, index2);
   const size_t index = xs_index(bit1, bit2);
   xs[index]++;
   n++;
+  dirty = true;
+  infoDirty = true;
 }
 
-void ComboNode::forward() {
-  const bool bit1 = node1.get_forward_bit(index1);
-  const bool bit2 = node2.get_forward_bit(index2);
-  forwardBits[0] = bit1 && bit2;
+void ComboNode::forward(Activation &activation) const {
+  const bool bit1 = node1.get_forward_bit(activation, index1);
+  const bool bit2 = node2.get_forward_bit(activation, index2);
+  activation.forwardBits[slot(activation, 0)] = bit1 && bit2;
 }
 
-void ComboNode::backward(const std::unordered_set<Node *> &unknown) {
+void ComboNode::backward(Activation &activation) const {
   // if (mutual_info() < 0.001 || n < 50000) {
   //   return;
   // }
 
-  const bool known1 = !unknown.count(&node1);
-  const bool known2 = !unknown.count(&node2);
+  const bool known1 = !activation.unknown[node1.get_id()];
+  const bool known2 = !activation.unknown[node2.get_id()];
   if (known1 == known2) {
     return;
   }
 
-  const bool bit1 = node1.get_forward_bit(index1);
-  const bool bit2 = node2.get_forward_bit(index2);
+  // only the known parent has a forward bit; if it is off, the combo says
+  // nothing about the unknown one
+  const bool bit1 = known1 && node1.get_forward_bit(activation, index1);
+  const bool bit2 = known2 && node2.get_forward_bit(activation, index2);
   if (!bit1 && !bit2) {
     return;
   }
-  double logMass = -std::numeric_limits<double>::infinity();
+  double *backwardLogPs = activation.backwardLogPs.data() + slot(activation, 0);
+  const size_t *backwardCounts =
+      activation.backwardCounts.data() + slot(activation, 0);
+  const double logN = log2_count(n);
   for (size_t i = 0; i < 4; i++) {
+    const double logP = dirty ? log2_count(xs[i]) - logN : logPs[i];
     if (backwardCounts[i]) {
-      backwardLogPs[i] += std::log2(xs[i]) - std::log2(n);
+      backwardLogPs[i] += logP;
     } else {
-      backwardLogPs[i] = std::log2(xs[i]) - std::log2(n);
+      backwardLogPs[i] = logP;
     }
-    logMass = log_add_exp(logMass, backwardLogPs[i]);
-  }
-  for (size_t i = 0; i < n_outputs(); i++) {
-    backwardLogPs[i] -= logMass;
   }
+  normalize_logprobs(backwardLogPs, n_outputs());
 
   const double trueLogP = known1 ? backwardLogPs[xs_index(bit1, true)]
                                  : backwardLogPs[xs_index(true, bit2)];
@@ -100,8 +138,8 @@ void ComboNode::backward(const std::unordered_set<Node *> &unknown) {
              : log_add_exp(backwardLogPs[xs_index(true, bit2)],
                            backwardLogPs[xs_index(false, bit2)]);
   const double loglh = logp - logBaseRate;
-  Node &node = known1 ? node2 : node1;
-  node.contribute_backward_loglh(index2, loglh);
+  const Node &node = known1 ? node2 : node1;
+  node.contribute_backward_loglh(activation, index2, loglh);
 }
 
 std::vector<double> ComboNode::entropy() const {
@@ -117,6 +155,17 @@ std::vector<double> ComboNode::potential() const {
   return std::vector<double>(n_outputs(), mutual_info());
 }
 
-size_t ComboNode::xs_index(bool bit1, bool bit2) const {
+void ComboNode::refresh() {
+  if (!dirty) {
+    return;
+  }
+  const double logN = log2_count(n);
+  for (size_t i = 0; i < 4; i++) {
+    logPs[i] = log2_count(xs[i]) - logN;
+  }
+  dirty = false;
+}
+
+size_t ComboNode::xs_index(bool bit1, bool bit2) {
   return ((size_t)bit1 << 0) + ((size_t)bit2 << 1);
 }
\ No newline at end of file
@@ -0,0 +1,74 @@
+#include "corpus.hpp"
+#include "trace.hpp"
+
+#include <cassert>
+#include <fstream>
+#include <unordered_set>
+
+corpus_t load_corpus(const std::string &filepath, string32_t delim) {
+  TRACE_SCOPE("load_corpus");
+  string32_t s;
+  {
+    std::ifstream ifs;
+    ifs.open(filepath);
+    assert(ifs.is_open());
+    char32_t codePoint;
+    sstream32_t ss;
+    while ((codePoint = utf::read_utf8(ifs)) != utf::END_STREAM) {
+      utf::write_utf32(codePoint, ss);
+    }
+    ifs.close();
+    s = ss.str();
+  }
+
+  std::vector<string32_t> out;
+  {
+    size_t oldPos = 0;
+    size_t newPos = 0;
+    while ((newPos = s.find(delim, oldPos)) != string32_t::npos) {
+      out.push_back(s.substr(oldPos, newPos - oldPos));
+      oldPos = newPos + delim.size();
+    }
+    out.push_back(s.substr(oldPos, s.size() - oldPos));
+  }
+
+  return out;
+}
+
+void for_each_poem(const std::string &filepath,
+                   const std::function<void(const string32_t &)> &onPoem,
+                   string32_t delim) {
+  TRACE_SCOPE("for_each_poem");
+  std::ifstream ifs;
+  ifs.open(filepath);
+  assert(ifs.is_open());
+  string32_t poem;
+  char32_t codePoint;
+  while ((codePoint = utf::read_utf8(ifs)) != utf::END_STREAM) {
+    poem.push_back(codePoint);
+    if (poem.size() >= delim.size() &&
+        poem.compare(poem.size() - delim.size(), delim.size(), delim) == 0) {
+      poem.resize(poem.size() - delim.size());
+      onPoem(poem);
+      poem.clear();
+    }
+  }
+  onPoem(poem);
+}
+
+Alphabet<> get_corpus_alphabet(const corpus_t &corpus) {
+  std::unordered_set<char32_t> letters;
+  for (const string32_t &s : corpus) {
+    letters.insert(s.cbegin(), s.cend());
+  }
+  return Alphabet<>(letters);
+}
+
+MemoryUsage corpus_memory_usage(const corpus_t &corpus) {
+  MemoryUsage usage;
+  usage.add("poems", memory::of(corpus));
+  for (const string32_t &s : corpus) {
+    usage.add("text", memory::of(s));
+  }
+  return usage;
+}
@@ -1,10 +1,28 @@
 #include "custom_net.hpp"
+#include "trace.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <fstream>
+#include <future>
 #include <iostream>
 #include <numeric>
+#include <tuple>
+
+namespace {
+Footprint footprint(const CustomNetModel::Workspace &workspace) {
+  const Activation &activation = workspace.activation;
+  Footprint out = memory::of(workspace.ps);
+  out += memory::of(activation.offsets);
+  out += memory::of(activation.words);
+  out += memory::of(activation.unknown);
+  out += memory::of(activation.forwardBits);
+  out += memory::of(activation.backwardLogPs);
+  out += memory::of(activation.backwardCounts);
+  return out;
+}
+} // namespace
 
 bool CustomNetModel::ComboSlot::operator<(const ComboSlot &other) const {
   if (&this->node1 < &other.node1)
@@ -27,13 +45,42 @@ bool CustomNetModel::ComboSlot::operator<(const ComboSlot &other) const {
 CustomNetModel::CustomNetModel(size_t windowLen,
                                const Alphabet<char32_t, uint32_t> &alphabet)
     : alphabet(alphabet), inputs(windowLen, InputNode(alphabet.size())),
-      serialInputs(), combos(), nObserved(0) {
+      serialInputs(), combos(), serialCombos(), nObserved(0), version(0),
+      pruneConfig{0.0, 0, 0, 1}, backgroundGrowth(false), searchVersion(0) {
   for (auto it = inputs.begin(); it != inputs.end(); it++) {
+    it->set_id(serialInputs.size());
     serialInputs.push_back(it);
   }
+  workspace = make_workspace();
+  trainWorkspace = make_workspace();
+}
+
+CustomNetModel::CustomNetModel(const Checkpoint &checkpoint)
+    : CustomNetModel(checkpoint.windowLen,
+                     Alphabet<char32_t, uint32_t>(checkpoint.alphabet)) {
+  TRACE_SCOPE("restore_checkpoint");
+  const size_t nWords = alphabet.size();
+  for (size_t i = 0; i < inputs.size(); i++) {
+    auto row = checkpoint.inputXs.begin() + i * nWords;
+    serialInputs[i]->set_counts(std::vector<size_t>(row, row + nWords),
+                                checkpoint.inputNs[i]);
+  }
+  for (const Checkpoint::Combo &combo : checkpoint.combos) {
+    const Checkpoint::Slot &slot = combo.slot;
+    add_combo_node(get_node(slot.node1), slot.index1, get_node(slot.node2),
+                   slot.index2);
+    serialCombos.back()->set_counts(
+        {combo.xs[0], combo.xs[1], combo.xs[2], combo.xs[3]});
+  }
+  for (const Checkpoint::Slot &slot : checkpoint.slots) {
+    comboSlots.insert(ComboSlot{get_node(slot.node1), get_node(slot.node2),
+                                slot.index1, slot.index2});
+  }
+  nObserved = checkpoint.nObserved;
+  refresh_caches();
 }
 
-typename CustomNetModel::State CustomNetModel::start() {
+typename CustomNetModel::State CustomNetModel::start() const {
   return State(inputs.size(), alphabet.serialize(utf::BEG_STRING));
 }
 
@@ -55,6 +102,9 @@ void CustomNetModel::add_combo_node(Node &node1, size_t index1, Node &node2,
     comboLevel = std::make_shared<std::list<ComboNode>>();
   }
   comboLevel->push_back(combo);
+  comboLevel->back().set_id(inputs.size() + serialCombos.size());
+  serialCombos.push_back(&comboLevel->back());
+  version++;
   comboSlots.insert(ComboSlot{node1, node2, index1, index2});
 }
 
@@ -76,116 +126,471 @@ bool CustomNetModel::combo_possible(size_t index1, char32_t c1, size_t index2,
                         get_input_node(index2), alphabet.serialize(c2));
 }
 
-void CustomNetModel::observe(State state, char32_t c) {
-  state.push_back(alphabet.serialize(c));
+void CustomNetModel::observe(const State &state, char32_t) {
+  TRACE_SCOPE_FINE("observe");
+  prepare(trainWorkspace);
+  Activation &activation = trainWorkspace.activation;
+  // the inputs learn the window itself, which ends just before c
   for (size_t i = 0; i < inputs.size(); i++) {
     InputNode &input = *serialInputs.at(i);
-    input.set_word(state[i]);
-    input.observe();
-    input.forward();
+    input.set_word(activation, state[i]);
+    input.observe(activation);
+    input.forward(activation);
   }
 
   for (auto &level : combos) {
     for (ComboNode &combo : *level.second) {
-      combo.observe();
-      combo.forward();
-    }
-  }
-
-  if (++nObserved % 1000 == 0) {
-    size_t count = 0;
-    auto openNodes = open_nodes();
-    for (OpenNode const &openNode1 : openNodes) {
-      for (OpenNode const &openNode2 : openNodes) {
-        if (combo_possible(openNode1.node, openNode1.index, openNode2.node,
-                           openNode2.index)) {
-          add_combo_node(openNode1.node, openNode1.index, openNode2.node,
-                         openNode2.index);
-          if (count++ >= 1)
-            break;
-        }
-      }
-      if (count >= 1)
-        break;
+      combo.observe(activation);
+      combo.forward(activation);
     }
   }
+
+  if (++nObserved % GROWTH_INTERVAL == 0) {
+    grow_combos();
+  }
 }
 
-typename CustomNetModel::State CustomNetModel::step(State state, char32_t c) {
-  state.push_back(alphabet.serialize(c));
-  state.erase(state.begin());
+typename CustomNetModel::State CustomNetModel::step(State state,
+                                                    char32_t c) const {
+  state.slide(alphabet.serialize(c));
   return state;
 }
 
 std::unordered_map<char32_t, double> CustomNetModel::probs(State state) {
-  InputNode &unknownInput = *serialInputs.back();
-  std::unordered_set<Node *> known;
-  std::unordered_set<Node *> unknown({&unknownInput});
+  refresh_caches();
+  const std::vector<double> &serialPs = probs(state, workspace);
+  std::unordered_map<char32_t, double> deserialPs;
+  for (uint32_t i = 0; i < serialPs.size(); i++) {
+    deserialPs.insert_or_assign(alphabet.deserialize(i), serialPs[i]);
+  }
+  return deserialPs;
+}
+
+typename CustomNetModel::Workspace CustomNetModel::make_workspace() const {
+  Workspace workspace{};
+  prepare(workspace);
+  return workspace;
+}
+
+const std::vector<double> &CustomNetModel::probs(const State &state,
+                                                 Workspace &workspace) const {
+  prepare(workspace);
+  Activation &activation = workspace.activation;
+  std::vector<bool> &unknown = activation.unknown;
+  unknown.assign(unknown.size(), false);
+  const InputNode &unknownInput = *serialInputs.back();
+  unknown[unknownInput.get_id()] = true;
 
   // forward pass
-  for (size_t i = 0; i < inputs.size() - 1; i++) {
-    InputNode &input = *serialInputs[i];
-    uint32_t c = state[i + 1];
-    input.set_word(c);
-    input.forward();
-    known.insert(&input);
-  }
-  for (auto &level : combos) {
-    for (ComboNode &combo : *level.second) {
-      if (unknown.count(&combo.get_node1()) ||
-          unknown.count(&combo.get_node2())) {
-        unknown.insert(&combo);
-        combo.clear_backward();
-      } else {
-        known.insert(&combo);
-        combo.forward();
+  {
+    TRACE_SCOPE_FINE("forward");
+    for (size_t i = 0; i < inputs.size() - 1; i++) {
+      const InputNode &input = *serialInputs[i];
+      uint32_t c = state[i + 1];
+      input.set_word(activation, c);
+      input.forward(activation);
+    }
+    for (auto &level : combos) {
+      for (const ComboNode &combo : *level.second) {
+        if (unknown[combo.get_node1().get_id()] ||
+            unknown[combo.get_node2().get_id()]) {
+          unknown[combo.get_id()] = true;
+          combo.clear_backward(activation);
+        } else {
+          combo.forward(activation);
+        }
       }
     }
   }
 
   // backward pass
-  unknownInput.clear_backward();
+  TRACE_SCOPE_FINE("backward");
+  unknownInput.clear_backward(activation);
   for (auto levelIt = combos.rbegin(); levelIt != combos.rend(); levelIt++) {
-    for (ComboNode &combo : *levelIt->second) {
-      if (unknown.count(&combo)) {
-        combo.backward(unknown);
+    for (const ComboNode &combo : *levelIt->second) {
+      if (unknown[combo.get_id()]) {
+        combo.backward(activation);
       }
     }
   }
-  unknownInput.backward(unknown);
+  unknownInput.backward(activation);
 
-  // deserialize
-  std::vector<double> serialPs = unknownInput.probs();
-  std::unordered_map<char32_t, double> deserialPs;
-  for (uint32_t i = 0; i < serialPs.size(); i++) {
-    deserialPs.insert_or_assign(alphabet.deserialize(i), serialPs[i]);
+  unknownInput.probs(activation, workspace.ps.data());
+  return workspace.ps;
+}
+
+double CustomNetModel::logprob(const State &state, char32_t c,
+                               Workspace &workspace) const {
+  return std::log2(probs(state, workspace)[alphabet.serialize(c)]);
+}
+
+const Alphabet<char32_t, uint32_t> &CustomNetModel::get_alphabet() const {
+  return alphabet;
+}
+
+void CustomNetModel::prepare(Workspace &workspace) const {
+  if (workspace.version == version && !workspace.ps.empty()) {
+    return;
   }
-  return deserialPs;
+  workspace.version = version;
+  Activation &activation = workspace.activation;
+  activation.offsets.resize(inputs.size() + serialCombos.size());
+  size_t nSlots = 0;
+  for (auto it : serialInputs) {
+    activation.offsets[it->get_id()] = nSlots;
+    nSlots += it->n_outputs();
+  }
+  for (const ComboNode *combo : serialCombos) {
+    activation.offsets[combo->get_id()] = nSlots;
+    nSlots += combo->n_outputs();
+  }
+  activation.words.assign(inputs.size(), 0);
+  activation.unknown.assign(activation.offsets.size(), false);
+  activation.forwardBits.assign(nSlots, false);
+  activation.backwardLogPs.assign(nSlots, 0.0);
+  activation.backwardCounts.assign(nSlots, 0);
+  workspace.ps.assign(alphabet.size(), 0.0);
 }
 
-std::multiset<typename CustomNetModel::OpenNode,
-              std::function<bool(const typename CustomNetModel::OpenNode &,
-                                 const typename CustomNetModel::OpenNode &)>>
-CustomNetModel::open_nodes() {
-  std::function<bool(const OpenNode &, const OpenNode &)> cmp =
-      [](const OpenNode &node1, const OpenNode &node2) {
-        return node1.potential > node2.potential;
-      };
-  std::multiset<OpenNode,
-                std::function<bool(const OpenNode &, const OpenNode &)>>
-      out(cmp);
+void CustomNetModel::refresh_caches() {
   for (InputNode &input : inputs) {
+    input.refresh();
+  }
+  for (ComboNode *combo : serialCombos) {
+    combo->refresh();
+  }
+}
+
+typename CustomNetModel::Replica CustomNetModel::make_replica() const {
+  Replica replica;
+  replica.inputXs.assign(inputs.size(),
+                         std::vector<size_t>(alphabet.size(), 0));
+  replica.comboXs.assign(serialCombos.size(), {0, 0, 0, 0});
+  replica.comboBits.assign(serialCombos.size(), false);
+  replica.nObserved = 0;
+  return replica;
+}
+
+void CustomNetModel::observe(Replica &replica, const State &state,
+                             char32_t) const {
+  TRACE_SCOPE_FINE("observe");
+  assert(replica.comboXs.size() == serialCombos.size());
+  const uint32_t *window = state.data();
+  for (size_t i = 0; i < inputs.size(); i++) {
+    replica.inputXs[i][window[i]]++;
+  }
+
+  // mirrors InputNode::forward and ComboNode::forward, but keeps the bits in
+  // the replica so the shared nodes are never written
+  auto bit = [&](const Node &node, size_t index) -> bool {
+    size_t id = node.get_id();
+    if (id < inputs.size()) {
+      return window[id] == index;
+    }
+    return replica.comboBits[id - inputs.size()];
+  };
+  for (auto &level : combos) {
+    for (const ComboNode &combo : *level.second) {
+      const bool bit1 = bit(combo.get_node1(), combo.get_index1());
+      const bool bit2 = bit(combo.get_node2(), combo.get_index2());
+      const size_t i = combo.get_id() - inputs.size();
+      replica.comboXs[i][combo.xs_index(bit1, bit2)]++;
+      replica.comboBits[i] = bit1 && bit2;
+    }
+  }
+  replica.nObserved++;
+}
+
+void CustomNetModel::merge(std::vector<Replica> &replicas) {
+  TRACE_SCOPE("merge");
+  const size_t before = nObserved;
+  for (Replica &replica : replicas) {
+    for (size_t i = 0; i < inputs.size(); i++) {
+      serialInputs[i]->add_counts(replica.inputXs[i]);
+    }
+    for (size_t i = 0; i < replica.comboXs.size(); i++) {
+      serialCombos[i]->add_counts(replica.comboXs[i]);
+    }
+    nObserved += replica.nObserved;
+  }
+
+  // growth happens once per interval crossed, exactly as in serial observe()
+  if (nObserved / GROWTH_INTERVAL > before / GROWTH_INTERVAL) {
+    grow_combos();
+  }
+
+  for (Replica &replica : replicas) {
+    replica = make_replica();
+  }
+  refresh_caches();
+}
+
+void CustomNetModel::grow_combos() {
+  TRACE_SCOPE("grow_combos");
+  std::vector<OpenSlot> openSlots;
+  if (pendingSearch.valid()) {
+    TRACE_SCOPE("wait_search");
+    openSlots = pendingSearch.get();
+  }
+  // ids are only stable while the graph is, so a ranking from before a
+  // change is no use
+  if (openSlots.empty() || searchVersion != version) {
+    openSlots = search_growth();
+  }
+  size_t count = 0;
+  for (const OpenSlot &openSlot1 : openSlots) {
+    Node &node1 = get_node(openSlot1.id);
+    for (const OpenSlot &openSlot2 : openSlots) {
+      Node &node2 = get_node(openSlot2.id);
+      if (combo_possible(node1, openSlot1.index, node2, openSlot2.index)) {
+        add_combo_node(node1, openSlot1.index, node2, openSlot2.index);
+        if (count++ >= 1)
+          break;
+      }
+    }
+    if (count >= 1)
+      break;
+  }
+
+  const bool infoDue =
+      pruneConfig.minMutualInfo > 0.0 &&
+      (nObserved / GROWTH_INTERVAL) % pruneConfig.interval == 0;
+  const bool overBudget =
+      pruneConfig.maxCombos && serialCombos.size() > pruneConfig.maxCombos;
+  if (infoDue || overBudget) {
+    prune_combos(infoDue);
+  }
+
+  if (backgroundGrowth) {
+    searchVersion = version;
+    pendingSearch = std::async(
+        std::launch::async,
+        [snapshot = snapshot_growth()]() { return search_growth(snapshot); });
+  }
+}
+
+typename CustomNetModel::GrowthSnapshot CustomNetModel::snapshot_growth() {
+  TRACE_SCOPE("snapshot_growth");
+  GrowthSnapshot snapshot;
+  snapshot.inputs.assign(inputs.begin(), inputs.end());
+  for (auto &level : combos) {
+    for (const ComboNode &combo : *level.second) {
+      snapshot.comboIds.push_back(combo.get_id());
+      snapshot.comboXs.push_back(combo.counts());
+    }
+  }
+  return snapshot;
+}
+
+// The inputs' outputs first, then forEachCombo(add) calls add(id, counts)
+// for each combo in level order. The multiset keeps equal potentials in
+// insertion order, which the pairing in grow_combos() depends on.
+template <class Inputs, class ForEachCombo>
+std::vector<typename CustomNetModel::OpenSlot>
+CustomNetModel::rank_growth(const Inputs &inputs, ForEachCombo forEachCombo) {
+  auto cmp = [](const OpenSlot &slot1, const OpenSlot &slot2) {
+    return slot1.potential > slot2.potential;
+  };
+  std::multiset<OpenSlot, decltype(cmp)> ranked(cmp);
+  for (const InputNode &input : inputs) {
     auto potential = input.potential();
     for (size_t i = 0; i < potential.size(); i++) {
-      out.insert(OpenNode{input, i, potential[i]});
+      ranked.insert(OpenSlot{input.get_id(), i, potential[i]});
     }
   }
-  for (auto level : combos) {
-    for (ComboNode &combo : *level.second) {
-      out.insert(OpenNode{combo, 0, combo.potential()[0]});
+  forEachCombo([&](size_t id, const std::array<size_t, 4> &xs) {
+    ranked.insert(OpenSlot{id, 0, ComboNode::mutual_info(xs)});
+  });
+  return std::vector<OpenSlot>(ranked.begin(), ranked.end());
+}
+
+std::vector<typename CustomNetModel::OpenSlot>
+CustomNetModel::search_growth() const {
+  TRACE_SCOPE("search_growth");
+  return rank_growth(inputs, [&](auto add) {
+    for (const auto &level : combos) {
+      for (const ComboNode &combo : *level.second) {
+        add(combo.get_id(), combo.counts());
+      }
+    }
+  });
+}
+
+std::vector<typename CustomNetModel::OpenSlot>
+CustomNetModel::search_growth(const GrowthSnapshot &snapshot) {
+  TRACE_SCOPE("search_growth");
+  return rank_growth(snapshot.inputs, [&](auto add) {
+    for (size_t i = 0; i < snapshot.comboIds.size(); i++) {
+      add(snapshot.comboIds[i], snapshot.comboXs[i]);
+    }
+  });
+}
+
+void CustomNetModel::prune_combos(bool checkInfo) {
+  TRACE_SCOPE("prune_combos");
+  std::vector<bool> evict(inputs.size() + serialCombos.size(), false);
+  for (ComboNode *combo : serialCombos) {
+    if (checkInfo && combo->n_observed() >= pruneConfig.minObservations &&
+        combo->mutual_info() < pruneConfig.minMutualInfo) {
+      evict[combo->get_id()] = true;
     }
   }
-  return out;
+  evict_descendants(evict);
+
+  if (pruneConfig.maxCombos) {
+    // mature combos rank by mutual info; immature ones only go if they must
+    std::vector<ComboNode *> ranked(serialCombos);
+    auto rank = [this](const ComboNode *combo) {
+      return std::make_pair(
+          combo->n_observed() >= pruneConfig.minObservations ? 0 : 1,
+          combo->mutual_info());
+    };
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [&](const ComboNode *c1, const ComboNode *c2) {
+                       return rank(c1) < rank(c2);
+                     });
+    size_t nKept = std::count(evict.begin() + inputs.size(), evict.end(),
+                              false);
+    for (auto it = ranked.begin(); it != ranked.end(); it++) {
+      if (nKept <= pruneConfig.maxCombos) {
+        break;
+      }
+      if (!evict[(*it)->get_id()]) {
+        evict[(*it)->get_id()] = true;
+        evict_descendants(evict);
+        nKept = std::count(evict.begin() + inputs.size(), evict.end(), false);
+      }
+    }
+  }
+
+  if (std::find(evict.begin(), evict.end(), true) == evict.end()) {
+    return;
+  }
+
+  // A slot whose parent goes away can never be filled again, but the slots
+  // of evicted combos stay taken so growth does not re-propose them at once.
+  for (auto it = comboSlots.begin(); it != comboSlots.end();) {
+    if (evict[it->node1.get_id()] || evict[it->node2.get_id()]) {
+      it = comboSlots.erase(it);
+    } else {
+      it++;
+    }
+  }
+
+  std::vector<ComboNode *> kept;
+  for (ComboNode *combo : serialCombos) {
+    if (!evict[combo->get_id()]) {
+      kept.push_back(combo);
+    }
+  }
+  for (auto levelIt = combos.begin(); levelIt != combos.end();) {
+    levelIt->second->remove_if(
+        [&](const ComboNode &combo) { return evict[combo.get_id()]; });
+    if (levelIt->second->empty()) {
+      levelIt = combos.erase(levelIt);
+    } else {
+      levelIt++;
+    }
+  }
+  serialCombos = kept;
+  for (size_t i = 0; i < serialCombos.size(); i++) {
+    serialCombos[i]->set_id(inputs.size() + i);
+  }
+  version++;
+}
+
+void CustomNetModel::evict_descendants(std::vector<bool> &evict) const {
+  for (auto &level : combos) {
+    for (const ComboNode &combo : *level.second) {
+      if (evict[combo.get_node1().get_id()] ||
+          evict[combo.get_node2().get_id()]) {
+        evict[combo.get_id()] = true;
+      }
+    }
+  }
+}
+
+Checkpoint
+CustomNetModel::checkpoint(const std::vector<uint64_t> &cursor) const {
+  Checkpoint checkpoint;
+  checkpoint.windowLen = inputs.size();
+  checkpoint.alphabet = alphabet.symbols();
+  for (auto it : serialInputs) {
+    checkpoint.inputXs.insert(checkpoint.inputXs.end(), it->counts().begin(),
+                              it->counts().end());
+    checkpoint.inputNs.push_back(it->n_observed());
+  }
+  for (const ComboNode *combo : serialCombos) {
+    std::array<size_t, 4> xs = combo->counts();
+    checkpoint.combos.push_back(Checkpoint::Combo{
+        {combo->get_node1().get_id(), combo->get_index1(),
+         combo->get_node2().get_id(), combo->get_index2()},
+        {xs[0], xs[1], xs[2], xs[3]}});
+  }
+  for (const ComboSlot &slot : comboSlots) {
+    checkpoint.slots.push_back(Checkpoint::Slot{
+        slot.node1.get_id(), slot.index1, slot.node2.get_id(), slot.index2});
+  }
+  // comboSlots is ordered by address; sort by id so files are reproducible
+  std::sort(checkpoint.slots.begin(), checkpoint.slots.end(),
+            [](const Checkpoint::Slot &s1, const Checkpoint::Slot &s2) {
+              return std::tie(s1.node1, s1.index1, s1.node2, s1.index2) <
+                     std::tie(s2.node1, s2.index1, s2.node2, s2.index2);
+            });
+  checkpoint.nObserved = nObserved;
+  checkpoint.cursor = cursor;
+  return checkpoint;
+}
+
+Node &CustomNetModel::get_node(size_t id) {
+  if (id < inputs.size()) {
+    return *serialInputs.at(id);
+  }
+  return *serialCombos.at(id - inputs.size());
+}
+
+void CustomNetModel::set_prune_config(const PruneConfig &config) {
+  assert(config.interval > 0);
+  pruneConfig = config;
+}
+
+void CustomNetModel::set_background_growth(bool enabled) {
+  backgroundGrowth = enabled;
+  if (!enabled && pendingSearch.valid()) {
+    pendingSearch.get();
+  }
+}
+
+size_t CustomNetModel::n_combos() const { return serialCombos.size(); }
+
+size_t CustomNetModel::context_size() const { return inputs.size() - 1; }
+
+// Every change either observes or changes the graph, and neither counter
+// ever goes down.
+size_t CustomNetModel::revision() const { return nObserved + version; }
+
+MemoryUsage CustomNetModel::memory_usage() const {
+  MemoryUsage usage;
+  usage.add("alphabet", alphabet.memory_usage());
+  usage.add("inputs", memory::of(inputs));
+  for (const InputNode &input : inputs) {
+    usage.add("inputs.counts", input.footprint());
+  }
+  usage.add("serialInputs", memory::of(serialInputs));
+  usage.add("combos", memory::of(combos));
+  for (const auto &level : combos) {
+    // make_shared puts the list next to a vtable pointer and two counts
+    usage.add("combos.levels",
+              {memory::heap_block(2 * sizeof(void *) +
+                                  sizeof(std::list<ComboNode>)),
+               0});
+    usage.add("combos.nodes", memory::of(*level.second));
+  }
+  usage.add("serialCombos", memory::of(serialCombos));
+  usage.add("comboSlots", memory::of(comboSlots));
+  usage.add("workspace", footprint(workspace));
+  usage.add("trainWorkspace", footprint(trainWorkspace));
+  return usage;
 }
 
 ostream8_t &CustomNetModel::desc_input(ostream8_t &os) {
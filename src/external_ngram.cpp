@@ -0,0 +1,456 @@
+#include "external_ngram.hpp"
+#include "trace.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace {
+const char MAGIC[8] = {'N', 'L', 'P', 'N', 'G', 'R', 'M', '\0'};
+const uint32_t FORMAT_VERSION = 1;
+const size_t RECORDS_PER_BLOCK =
+    ExternalNGramSorter::BLOCK_BYTES / sizeof(NGramRecord);
+
+std::runtime_error error(const std::string &what) {
+  return std::runtime_error("external ngram: " + what);
+}
+
+// Appends records to a stream one block at a time.
+class RecordWriter {
+public:
+  RecordWriter(std::ostream &os, const std::string &path)
+      : os(os), path(path), nWritten(0) {
+    buffer.reserve(RECORDS_PER_BLOCK);
+  }
+
+  void push(const NGramRecord &record) {
+    buffer.push_back(record);
+    nWritten++;
+    if (buffer.size() == RECORDS_PER_BLOCK) {
+      flush();
+    }
+  }
+
+  void flush() {
+    os.write(reinterpret_cast<const char *>(buffer.data()),
+             buffer.size() * sizeof(NGramRecord));
+    if (!os) {
+      throw error("write to " + path + " failed");
+    }
+    buffer.clear();
+  }
+
+  size_t n_written() const { return nWritten; }
+
+private:
+  std::ostream &os;
+  std::string path;
+  std::vector<NGramRecord> buffer;
+  size_t nWritten;
+};
+
+// Reads a run file front to back one block at a time.
+class RecordReader {
+public:
+  explicit RecordReader(const std::string &path)
+      : ifs(path, std::ios::binary), path(path), pos(0) {
+    if (!ifs.is_open()) {
+      throw error("cannot open " + path);
+    }
+    refill();
+  }
+
+  bool done() const { return pos == buffer.size(); }
+  const NGramRecord &front() const { return buffer[pos]; }
+
+  void pop() {
+    if (++pos == buffer.size()) {
+      refill();
+    }
+  }
+
+private:
+  void refill() {
+    buffer.resize(RECORDS_PER_BLOCK);
+    ifs.read(reinterpret_cast<char *>(buffer.data()),
+             buffer.size() * sizeof(NGramRecord));
+    if (ifs.bad() || ifs.gcount() % sizeof(NGramRecord)) {
+      throw error("cannot read " + path);
+    }
+    buffer.resize(ifs.gcount() / sizeof(NGramRecord));
+    pos = 0;
+  }
+
+private:
+  std::ifstream ifs;
+  std::string path;
+  std::vector<NGramRecord> buffer;
+  size_t pos;
+};
+
+// Merges sorted runs into one sorted sequence, adding up the counts of equal
+// keys, and passes each record to out.
+template <class F>
+void merge_runs(const std::vector<std::string> &paths, F &&out) {
+  TRACE_SCOPE("merge_runs");
+  std::vector<std::unique_ptr<RecordReader>> readers;
+  using Head = std::pair<uint64_t, size_t>;
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+  for (const std::string &path : paths) {
+    readers.push_back(std::make_unique<RecordReader>(path));
+    if (!readers.back()->done()) {
+      heads.emplace(readers.back()->front().key, readers.size() - 1);
+    }
+  }
+  NGramRecord current{0, 0};
+  bool started = false;
+  while (!heads.empty()) {
+    size_t i = heads.top().second;
+    heads.pop();
+    NGramRecord record = readers[i]->front();
+    readers[i]->pop();
+    if (!readers[i]->done()) {
+      heads.emplace(readers[i]->front().key, i);
+    }
+    if (started && record.key == current.key) {
+      current.count += record.count;
+    } else {
+      if (started) {
+        out(current);
+      }
+      current = record;
+      started = true;
+    }
+  }
+  if (started) {
+    out(current);
+  }
+}
+
+unsigned symbol_bits(size_t nSymbols) {
+  unsigned bits = 1;
+  while (((size_t)1 << bits) < nSymbols) {
+    bits++;
+  }
+  return bits;
+}
+} // namespace
+
+ExternalNGramSorter::ExternalNGramSorter(
+    size_t n, const Alphabet<char32_t, uint32_t> &alphabet,
+    const std::string &outputPath, size_t memoryBudget)
+    : alphabet(alphabet), n(n), bits(symbol_bits(alphabet.size())),
+      outputPath(outputPath), memoryBudget(memoryBudget), nextRun(0),
+      nObserved(0) {
+  if (!n || n * bits > 64) {
+    throw error("order " + std::to_string(n) + " does not fit in 64 bits");
+  }
+  if (memoryBudget < (n + 3) * BLOCK_BYTES) {
+    throw error("memory budget below " +
+                std::to_string((n + 3) * BLOCK_BYTES >> 20) + " MiB");
+  }
+  // one block is left for writing runs out
+  keys.reserve((memoryBudget - BLOCK_BYTES) / sizeof(uint64_t));
+}
+
+ExternalNGramSorter::~ExternalNGramSorter() {
+  for (const std::string &run : runs) {
+    std::remove(run.c_str());
+  }
+}
+
+void ExternalNGramSorter::observe(const uint32_t *window, char32_t c) {
+  uint64_t key = 0;
+  for (size_t i = 0; i + 1 < n; i++) {
+    key = key << bits | window[i];
+  }
+  keys.push_back(key << bits | alphabet.serialize(c));
+  nObserved++;
+  if (keys.size() == keys.capacity()) {
+    spill();
+  }
+}
+
+void ExternalNGramSorter::spill() {
+  TRACE_SCOPE("spill_run");
+  std::sort(keys.begin(), keys.end());
+  runs.push_back(run_path(nextRun++));
+  std::ofstream ofs(runs.back(), std::ios::binary | std::ios::trunc);
+  if (!ofs.is_open()) {
+    throw error("cannot open " + runs.back());
+  }
+  RecordWriter writer(ofs, runs.back());
+  for (size_t i = 0; i < keys.size();) {
+    size_t j = i + 1;
+    while (j < keys.size() && keys[j] == keys[i]) {
+      j++;
+    }
+    writer.push(NGramRecord{keys[i], j - i});
+    i = j;
+  }
+  writer.flush();
+  keys.clear();
+}
+
+std::string ExternalNGramSorter::run_path(size_t run) const {
+  return outputPath + ".run" + std::to_string(run);
+}
+
+// File layout, native endian: MAGIC, u32 version, u32 bits per symbol, u64 n,
+// u64 alphabet size, the alphabet's symbols() as char32_t, padding to 8
+// bytes, u64 record counts of orders 1 to n, then the records of orders n
+// down to 1, each sorted by key.
+size_t ExternalNGramSorter::write() {
+  TRACE_SCOPE("write_ngram_counts");
+  if (!keys.empty() || runs.empty()) {
+    spill();
+  }
+  // every run being merged, and every order being written, holds a block
+  const size_t fanIn = std::max<size_t>(memoryBudget / BLOCK_BYTES - n, 2);
+  keys = std::vector<uint64_t>();
+  while (runs.size() > fanIn) {
+    std::vector<std::string> group(runs.begin(), runs.begin() + fanIn);
+    runs.erase(runs.begin(), runs.begin() + fanIn);
+    runs.push_back(run_path(nextRun++));
+    {
+      std::ofstream ofs(runs.back(), std::ios::binary | std::ios::trunc);
+      if (!ofs.is_open()) {
+        throw error("cannot open " + runs.back());
+      }
+      RecordWriter writer(ofs, runs.back());
+      merge_runs(group, [&](const NGramRecord &r) { writer.push(r); });
+      writer.flush();
+    }
+    for (const std::string &run : group) {
+      std::remove(run.c_str());
+    }
+  }
+
+  const std::string tmpPath = outputPath + ".tmp";
+  std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!ofs.is_open()) {
+    throw error("cannot open " + tmpPath);
+  }
+  const std::vector<char32_t> symbols = alphabet.symbols();
+  const uint64_t nSymbols = symbols.size();
+  const uint64_t order = n;
+  ofs.write(MAGIC, sizeof(MAGIC));
+  ofs.write(reinterpret_cast<const char *>(&FORMAT_VERSION), 4);
+  ofs.write(reinterpret_cast<const char *>(&bits), 4);
+  ofs.write(reinterpret_cast<const char *>(&order), 8);
+  ofs.write(reinterpret_cast<const char *>(&nSymbols), 8);
+  ofs.write(reinterpret_cast<const char *>(symbols.data()), 4 * nSymbols);
+  const uint64_t zero = 0;
+  ofs.write(reinterpret_cast<const char *>(&zero), 4 * (nSymbols % 2));
+  const std::streamoff countsOffset = ofs.tellp();
+  std::vector<uint64_t> counts(n);
+  ofs.write(reinterpret_cast<const char *>(counts.data()), 8 * n);
+
+  // Lower orders are the distinct prefixes of the order-n keys, which arrive
+  // sorted, so each is accumulated until its prefix changes and written to a
+  // file of its own, to be appended after order n.
+  struct Lower {
+    std::string path;
+    std::ofstream ofs;
+    std::unique_ptr<RecordWriter> writer;
+    NGramRecord current;
+  };
+  std::vector<Lower> lower(n - 1);
+  for (size_t k = 1; k < n; k++) {
+    Lower &l = lower[k - 1];
+    l.path = outputPath + ".order" + std::to_string(k);
+    l.ofs.open(l.path, std::ios::binary | std::ios::trunc);
+    if (!l.ofs.is_open()) {
+      throw error("cannot open " + l.path);
+    }
+    l.writer = std::make_unique<RecordWriter>(l.ofs, l.path);
+    l.current = NGramRecord{0, 0};
+  }
+  {
+    RecordWriter writer(ofs, tmpPath);
+    merge_runs(runs, [&](const NGramRecord &r) {
+      writer.push(r);
+      for (size_t k = 1; k < n; k++) {
+        Lower &l = lower[k - 1];
+        uint64_t prefix = r.key >> (bits * (n - k));
+        if (l.current.count && l.current.key != prefix) {
+          l.writer->push(l.current);
+          l.current.count = 0;
+        }
+        l.current.key = prefix;
+        l.current.count += r.count;
+      }
+    });
+    writer.flush();
+    counts[n - 1] = writer.n_written();
+  }
+  std::vector<char> block(BLOCK_BYTES);
+  for (size_t k = n - 1; k >= 1; k--) {
+    Lower &l = lower[k - 1];
+    if (l.current.count) {
+      l.writer->push(l.current);
+    }
+    l.writer->flush();
+    counts[k - 1] = l.writer->n_written();
+    l.ofs.close();
+    std::ifstream ifs(l.path, std::ios::binary);
+    while (ifs.read(block.data(), block.size()) || ifs.gcount()) {
+      ofs.write(block.data(), ifs.gcount());
+    }
+    ifs.close();
+    std::remove(l.path.c_str());
+  }
+  ofs.seekp(countsOffset);
+  ofs.write(reinterpret_cast<const char *>(counts.data()), 8 * n);
+  ofs.seekp(0, std::ios::end);
+  const size_t bytes = (size_t)ofs.tellp();
+  ofs.close();
+  if (!ofs) {
+    throw error("write to " + tmpPath + " failed");
+  }
+  if (std::rename(tmpPath.c_str(), outputPath.c_str())) {
+    throw error("cannot rename to " + outputPath);
+  }
+  for (const std::string &run : runs) {
+    std::remove(run.c_str());
+  }
+  runs.clear();
+  return bytes;
+}
+
+size_t ExternalNGramSorter::n_runs() const { return nextRun; }
+
+size_t ExternalNGramSorter::n_observed() const { return nObserved; }
+
+NGramFile::NGramFile(const std::string &path, double smoothing)
+    : alphabet(std::unordered_set<char32_t>()), n(0), bits(0),
+      smoothing(smoothing), mapping(nullptr), mappingBytes(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw error("cannot open " + path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < 40) {
+    close(fd);
+    throw error(path + " is not an n-gram file");
+  }
+  mappingBytes = (size_t)st.st_size;
+  mapping = mmap(nullptr, mappingBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    mapping = nullptr;
+    throw error("cannot map " + path);
+  }
+
+  try {
+    const char *data = static_cast<const char *>(mapping);
+    uint32_t version, fileBits;
+    uint64_t order, nSymbols;
+    std::memcpy(&version, data + 8, 4);
+    std::memcpy(&fileBits, data + 12, 4);
+    std::memcpy(&order, data + 16, 8);
+    std::memcpy(&nSymbols, data + 24, 8);
+    if (std::memcmp(data, MAGIC, sizeof(MAGIC))) {
+      throw error(path + " is not an n-gram file");
+    }
+    if (version != FORMAT_VERSION) {
+      throw error("unsupported format version");
+    }
+    size_t offset = 32 + (nSymbols + nSymbols % 2) * 4;
+    if (nSymbols < 3 || order < 1 || order * fileBits > 64 ||
+        offset + 8 * order > mappingBytes) {
+      throw error(path + " has a corrupt header");
+    }
+    std::vector<char32_t> symbols(nSymbols);
+    std::memcpy(symbols.data(), data + 32, 4 * nSymbols);
+    alphabet = Alphabet<char32_t, uint32_t>(symbols);
+    n = order;
+    bits = fileBits;
+
+    orderSizes.resize(n);
+    std::memcpy(orderSizes.data(), data + offset, 8 * n);
+    offset += 8 * n;
+    orders.resize(n);
+    for (size_t k = n; k >= 1; k--) {
+      if (orderSizes[k - 1] > (mappingBytes - offset) / sizeof(NGramRecord)) {
+        throw error(path + " is truncated");
+      }
+      orders[k - 1] = reinterpret_cast<const NGramRecord *>(data + offset);
+      offset += orderSizes[k - 1] * sizeof(NGramRecord);
+    }
+  } catch (...) {
+    munmap(mapping, mappingBytes);
+    throw;
+  }
+}
+
+NGramFile::~NGramFile() {
+  if (mapping) {
+    munmap(mapping, mappingBytes);
+  }
+}
+
+const std::vector<double> &NGramFile::probs(const uint32_t *window,
+                                            std::vector<double> &probs) const {
+  probs.assign(alphabet.size(), 1.0 / alphabet.size());
+  for (size_t i = 0; i < n; i++) {
+    // order k keys whose first k - 1 symbols are the context
+    const size_t k = n - i;
+    uint64_t context = 0;
+    for (size_t j = i; j + 1 < n; j++) {
+      context = context << bits | window[j];
+    }
+    const NGramRecord *begin = orders[k - 1];
+    const NGramRecord *end = begin + orderSizes[k - 1];
+    const unsigned shift = bits;
+    const NGramRecord *first = std::partition_point(
+        begin, end,
+        [&](const NGramRecord &r) { return (r.key >> shift) < context; });
+    const NGramRecord *last = std::partition_point(
+        first, end,
+        [&](const NGramRecord &r) { return (r.key >> shift) == context; });
+    if (first == last) {
+      continue;
+    }
+    uint64_t total = 0;
+    for (const NGramRecord *r = first; r != last; r++) {
+      total += r->count;
+    }
+    double denominator = (double)total + smoothing * alphabet.size();
+    std::fill(probs.begin(), probs.end(), smoothing / denominator);
+    const uint64_t mask = ((uint64_t)1 << bits) - 1;
+    for (const NGramRecord *r = first; r != last; r++) {
+      probs[r->key & mask] = ((double)r->count + smoothing) / denominator;
+    }
+    break;
+  }
+  return probs;
+}
+
+const Alphabet<char32_t, uint32_t> &NGramFile::get_alphabet() const {
+  return alphabet;
+}
+
+size_t NGramFile::get_n() const { return n; }
+
+size_t NGramFile::n_records(size_t k) const { return orderSizes[k - 1]; }
+
+size_t NGramFile::file_bytes() const { return mappingBytes; }
+
+MemoryUsage NGramFile::memory_usage() const {
+  MemoryUsage usage;
+  usage.add("alphabet", alphabet.memory_usage());
+  usage.add("orders", memory::of(orders));
+  usage.add("orderSizes", memory::of(orderSizes));
+  return usage;
+}
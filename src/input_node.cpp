@@ -1,51 +1,100 @@
 #include "input_node.hpp"
 #include "util.hpp"
 
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <limits>
 
-InputNode::InputNode(size_t nWords) : Node(0, 0, nWords), xs(nWords, 1), n(2) {}
+InputNode::InputNode(size_t nWords)
+    : Node(0, 0, nWords), xs(nWords, 1), n(2), logPs(nWords, 0.0),
+      dirty(true) {}
 
-void InputNode::set_word(uint32_t word) { this->word = word; }
+void InputNode::set_word(Activation &activation, uint32_t word) const {
+  activation.words[id] = word;
+}
 
-std::vector<double> InputNode::probs() const {
-  std::vector<double> ps = logprobs();
-  double total = 0.0;
-  for (double &p : ps) {
-    p = std::exp2(p);
-    total += p;
-  }
-  for (double &p : ps) {
-    p /= total;
-  }
+std::vector<double> InputNode::probs(const Activation &activation) const {
+  std::vector<double> ps(n_outputs());
+  probs(activation, ps.data());
   return ps;
 }
 
-std::vector<double> InputNode::logprobs() const { return backwardLogPs; }
+void InputNode::probs(const Activation &activation, double *out) const {
+  logprobs_to_probs(activation.backwardLogPs.data() + slot(activation, 0), out,
+                    n_outputs());
+}
+
+std::vector<double> InputNode::logprobs(const Activation &activation) const {
+  auto begin = activation.backwardLogPs.begin() + slot(activation, 0);
+  return std::vector<double>(begin, begin + n_outputs());
+}
+
+const std::vector<size_t> &InputNode::counts() const { return xs; }
+
+void InputNode::add_counts(const std::vector<size_t> &delta) {
+  assert(delta.size() == xs.size());
+  for (size_t i = 0; i < xs.size(); i++) {
+    xs[i] += delta[i];
+    n += delta[i];
+  }
+  dirty = true;
+}
+
+void InputNode::set_counts(const std::vector<size_t> &xs, size_t n) {
+  assert(xs.size() == this->xs.size());
+  this->xs = xs;
+  this->n = n;
+  dirty = true;
+}
+
+size_t InputNode::n_observed() const { return n; }
+
+Footprint InputNode::footprint() const {
+  Footprint out = memory::of(xs);
+  out += memory::of(logPs);
+  return out;
+}
 
-void InputNode::observe() {
-  xs[word]++;
+void InputNode::observe(const Activation &activation) {
+  xs[activation.words[id]]++;
   n++;
+  dirty = true;
 }
 
-void InputNode::forward() {
-  forwardBits.assign(n_outputs(), false);
-  forwardBits.at(word) = true;
+void InputNode::forward(Activation &activation) const {
+  const size_t begin = slot(activation, 0);
+  std::fill(activation.forwardBits.begin() + begin,
+            activation.forwardBits.begin() + begin + n_outputs(), false);
+  activation.forwardBits[begin + activation.words[id]] = true;
 }
 
-void InputNode::backward(const std::unordered_set<Node *> &unknown) {
-  double logMass = -std::numeric_limits<double>::infinity();
+void InputNode::backward(Activation &activation) const {
+  double *backwardLogPs = activation.backwardLogPs.data() + slot(activation, 0);
+  const size_t *backwardCounts =
+      activation.backwardCounts.data() + slot(activation, 0);
+  const double logN = log2_count(n);
   for (size_t i = 0; i < n_outputs(); i++) {
+    const double logP = dirty ? log2_count(xs[i]) - logN : logPs[i];
     if (backwardCounts[i]) {
-      backwardLogPs[i] += std::log2(xs[i]) - std::log2(n);
+      backwardLogPs[i] += logP;
     } else {
-      backwardLogPs[i] = std::log2(xs[i]) - std::log2(n);
+      backwardLogPs[i] = logP;
     }
-    logMass = log_add_exp(logMass, backwardLogPs[i]);
   }
-  for (size_t i = 0; i < n_outputs(); i++) {
-    backwardLogPs[i] -= logMass;
+  normalize_logprobs(backwardLogPs, n_outputs());
+}
+
+void InputNode::refresh() {
+  if (!dirty) {
+    return;
+  }
+  log2_counts(xs.data(), logPs.data(), xs.size());
+  const double logN = log2_count(n);
+  for (double &logP : logPs) {
+    logP -= logN;
   }
+  dirty = false;
 }
 
 std::vector<double> InputNode::entropy() const {
@@ -57,4 +106,4 @@ std::vector<double> InputNode::entropy() const {
   return out;
 }
 
-std::vector<double> InputNode::potential() const { return entropy(); }
\ No newline at end of file
+std::vector<double> InputNode::potential() const { return entropy(); }
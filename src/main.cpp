@@ -1,17 +1,38 @@
+#include "alloc_counter.hpp"
+#include "beam_search.hpp"
+#include "bpe.hpp"
+#include "checkpoint.hpp"
+#include "corpus.hpp"
 #include "custom_net.hpp"
+#include "distribution_cache.hpp"
+#include "external_ngram.hpp"
 #include "ngram.hpp"
+#include "online_ngram.hpp"
+#include "philox.hpp"
+#include "perf_report.hpp"
 #include "progress.hpp"
+#include "suffix_array_model.hpp"
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include "transformer_model.hpp"
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <chrono>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
-#include <random>
-
-using corpus_t = std::vector<string32_t>;
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
 
 template <class M> void train(M &model, const string32_t &s) {
+  TRACE_SCOPE("train_poem");
   using State = typename M::State;
   string32_t str = s;
   str.append(1, utf::END_STRING);
@@ -22,80 +43,322 @@ template <class M> void train(M &model, const string32_t &s) {
   }
 }
 
+// Trains on poems [begin, end) of trainCorpus, calling onPoem with the index
+// of the next poem after each one. Training stops early once onPoem returns
+// false. Returns the index of the first poem not trained on.
 template <class M>
-void train(M &model, const corpus_t &trainCorpus, const corpus_t &valCorpus) {
-  Progress pbar(trainCorpus.size());
-  for (const string32_t s : trainCorpus) {
-    train(model, s);
-    pbar.add(1);
+size_t train(M &model, const corpus_t &trainCorpus, size_t begin = 0,
+             const std::function<bool(size_t)> &onPoem = nullptr) {
+  Progress pbar(trainCorpus.size(), "train", begin);
+  for (size_t i = begin; i < trainCorpus.size(); i++) {
+    train(model, trainCorpus[i]);
+    pbar.add(1, trainCorpus[i].size() + 1);
+    if (onPoem && !onPoem(i + 1)) {
+      return i + 1;
+    }
+  }
+  return trainCorpus.size();
+}
+
+// Data-parallel training: worker w observes poems w, w + nThreads, ... into a
+// private replica, and after every GROWTH_INTERVAL observations all replicas
+// are merged and the graph grown once. Each worker has a fixed quota per round,
+// so the result depends only on nThreads and not on scheduling.
+//
+// The cursor is {nThreads, then poem, pos, finished for each worker}. It is
+// passed to onRound after every merge, and a non-empty cursor resumes from it.
+// Training stops early once onRound returns false.
+void train_parallel(
+    CustomNetModel &model, const corpus_t &trainCorpus, size_t nThreads,
+    const std::vector<uint64_t> &cursor = {},
+    const std::function<bool(const std::vector<uint64_t> &)> &onRound =
+        nullptr) {
+  using State = CustomNetModel::State;
+  struct Stream {
+    size_t poem;
+    size_t pos;
+    State state;
+    size_t finished;
+  };
+
+  ThreadPool pool(nThreads);
+  std::vector<CustomNetModel::Replica> replicas(nThreads,
+                                                model.make_replica());
+  std::vector<Stream> streams;
+  for (size_t w = 0; w < nThreads; w++) {
+    streams.push_back(Stream{w, 0, model.start(), 0});
+  }
+  if (!cursor.empty()) {
+    assert(cursor.size() == 1 + 3 * nThreads && cursor[0] == nThreads);
+    for (size_t w = 0; w < nThreads; w++) {
+      Stream &stream = streams[w];
+      stream.poem = cursor[1 + 3 * w];
+      stream.pos = cursor[2 + 3 * w];
+      stream.finished = cursor[3 + 3 * w];
+      // the window is a function of the position, so replay it
+      for (size_t i = 0; i < stream.pos; i++) {
+        stream.state = model.step(stream.state, trainCorpus[stream.poem][i]);
+      }
+    }
+  }
+
+  size_t resumed = 0;
+  for (const Stream &stream : streams) {
+    resumed += stream.finished;
+  }
+  Progress pbar(trainCorpus.size(), "train", resumed);
+  std::vector<size_t> observed(nThreads);
+  size_t nChars = 0;
+  bool done = false;
+  while (!done) {
+    pool.run(nThreads, [&](size_t w) {
+      TRACE_SCOPE("observe_quota");
+      Stream &stream = streams[w];
+      size_t quota = CustomNetModel::GROWTH_INTERVAL / nThreads +
+                     (w < CustomNetModel::GROWTH_INTERVAL % nThreads);
+      observed[w] = quota;
+      while (quota && stream.poem < trainCorpus.size()) {
+        const string32_t &s = trainCorpus[stream.poem];
+        char32_t c = stream.pos < s.size() ? s[stream.pos] : utf::END_STRING;
+        model.observe(replicas[w], stream.state, c);
+        stream.state = model.step(stream.state, c);
+        quota--;
+        if (++stream.pos > s.size()) {
+          stream.poem += nThreads;
+          stream.pos = 0;
+          stream.finished++;
+          stream.state = model.start();
+        }
+      }
+      observed[w] -= quota;
+    });
+    model.merge(replicas);
+
+    size_t finished = 0;
+    for (size_t w = 0; w < nThreads; w++) {
+      nChars += observed[w];
+    }
+    done = true;
+    std::vector<uint64_t> roundCursor = {nThreads};
+    for (const Stream &stream : streams) {
+      finished += stream.finished;
+      done = done && stream.poem >= trainCorpus.size();
+      roundCursor.insert(roundCursor.end(),
+                         {stream.poem, stream.pos, stream.finished});
+    }
+    pbar.set(finished, nChars);
+    if (onRound && !onRound(roundCursor)) {
+      break;
+    }
   }
 }
 
-template <class M> double perplexity(M &model, const string32_t &s) {
+template <class M>
+double perplexity(M &model, const string32_t &s,
+                  typename M::Workspace &workspace,
+                  DistributionCache<M> *cache = nullptr) {
+  TRACE_SCOPE("score_poem");
   using State = typename M::State;
   string32_t str = s;
   str.append(1, utf::END_STRING);
   double logprob = 0.0;
   State state = model.start();
   for (char32_t c : str) {
-    auto probs = model.probs(state);
-    double prob = probs.count(c) ? probs.at(c) : probs.at(utf::UNKNOWN);
-    logprob -= std::log2(prob);
+    logprob -= cache ? cache->logprob(state, c, workspace)
+                     : model.logprob(state, c, workspace);
     state = model.step(state, c);
   }
   logprob /= str.size();
   return std::exp2(logprob);
 }
 
-template <class M> double perplexity(M &model, const corpus_t &corpus) {
-  Progress pbar(corpus.size());
+// cacheSize is the number of distributions kept per scoring thread; 0 scores
+// without a cache.
+template <class M>
+double perplexity(M &model, const corpus_t &corpus, size_t cacheSize = 0) {
+  Progress pbar(corpus.size(), "score");
+  typename M::Workspace workspace = model.make_workspace();
+  std::unique_ptr<DistributionCache<M>> cache;
+  if (cacheSize) {
+    cache = std::make_unique<DistributionCache<M>>(model, cacheSize);
+  }
   double avg = 0.0;
-  for (string32_t s : corpus) {
-    avg += std::log2(perplexity(model, s));
-    pbar.add(1);
+  for (const string32_t &s : corpus) {
+    avg += std::log2(perplexity(model, s, workspace, cache.get()));
+    pbar.add(1, s.size() + 1);
+  }
+  if (cache) {
+    std::cerr << "score cache: " << cache->hit_rate() * 100.0 << "% hits"
+              << std::endl;
   }
   avg /= corpus.size();
   return std::exp2(avg);
 }
 
-template <class M> string32_t generate_best(M &model, size_t maxLen) {
-  using State = typename M::State;
-  string32_t out;
-  State state = model.start();
-  for (size_t i = 0; i < maxLen; i++) {
-    auto probs = model.probs(state);
-    auto bestIt =
-        std::max_element(probs.begin(), probs.end(),
-                         [](const typename decltype(probs)::value_type &v1,
-                            const typename decltype(probs)::value_type &v2) {
-                           return v1.second < v2.second;
-                         });
-    char32_t c = bestIt->first;
-    if (c == utf::END_STRING) {
-      break;
-    } else {
-      out.append(1, c);
-      state = model.step(state, c);
+// Scores the corpus on nThreads threads, each with its own workspace against
+// one const model. Per-poem results are summed in corpus order, so the result
+// does not depend on the thread count.
+template <class M>
+double perplexity(const M &model, const corpus_t &corpus, size_t nThreads,
+                  size_t cacheSize = 0) {
+  ThreadPool pool(nThreads);
+  std::vector<double> logPerplexities(corpus.size());
+  std::atomic<size_t> next(0);
+  std::atomic<size_t> nHits(0), nMisses(0);
+  Progress pbar(corpus.size(), "score");
+  pool.run(nThreads, [&](size_t) {
+    typename M::Workspace workspace = model.make_workspace();
+    std::unique_ptr<DistributionCache<const M>> cache;
+    if (cacheSize) {
+      cache = std::make_unique<DistributionCache<const M>>(model, cacheSize);
     }
+    for (size_t i; (i = next++) < corpus.size();) {
+      logPerplexities[i] = std::log2(
+          perplexity(model, corpus[i], workspace, cache.get()));
+      pbar.add(1, corpus[i].size() + 1);
+    }
+    if (cache) {
+      nHits += cache->hits();
+      nMisses += cache->misses();
+    }
+  });
+  if (cacheSize && nHits + nMisses) {
+    std::cerr << "score cache: " << nHits * 100.0 / (nHits + nMisses)
+              << "% hits" << std::endl;
   }
-  return out;
+  double avg = 0.0;
+  for (double logPerplexity : logPerplexities) {
+    avg += logPerplexity;
+  }
+  avg /= corpus.size();
+  return std::exp2(avg);
 }
 
-template <class M> string32_t generate_random(M &model, size_t maxLen) {
+// Scores a model trained on BPE tokens against the characters of corpus.
+// Each poem's token log-likelihood, END included, is spread over its
+// characters and END, so the result compares with character-level
+// perplexity(); poems are averaged the same way.
+template <class M>
+double perplexity_per_char(const M &model, const BpeTokenizer &tokenizer,
+                           const corpus_t &corpus, size_t nThreads,
+                           size_t cacheSize = 0) {
+  ThreadPool pool(nThreads);
+  std::vector<double> logPerplexities(corpus.size());
+  std::atomic<size_t> next(0);
+  Progress pbar(corpus.size(), "score");
+  pool.run(nThreads, [&](size_t) {
+    typename M::Workspace workspace = model.make_workspace();
+    std::unique_ptr<DistributionCache<const M>> cache;
+    if (cacheSize) {
+      cache = std::make_unique<DistributionCache<const M>>(model, cacheSize);
+    }
+    for (size_t i; (i = next++) < corpus.size();) {
+      string32_t tokens = tokenizer.encode(corpus[i]);
+      logPerplexities[i] =
+          std::log2(perplexity(model, tokens, workspace, cache.get())) *
+          (tokens.size() + 1) / (corpus[i].size() + 1);
+      pbar.add(1, corpus[i].size() + 1);
+    }
+  });
+  double avg = 0.0;
+  for (double logPerplexity : logPerplexities) {
+    avg += logPerplexity;
+  }
+  avg /= corpus.size();
+  return std::exp2(avg);
+}
+
+// Scores snapshots of a CustomNetModel on valCorpus on a background thread
+// while training continues. submit() first collects the previous validation,
+// so results depend only on where validations happen and not on timing. The
+// best snapshot is kept, and should_stop() turns true after patience results
+// in a row without a new best (never if patience is 0).
+class BackgroundValidator {
+public:
+  BackgroundValidator(const corpus_t &valCorpus, size_t patience)
+      : valCorpus(valCorpus), patience(patience),
+        bestPerplexity(std::numeric_limits<double>::infinity()), bestPoem(0),
+        lastPoem(0), sinceBest(0) {}
+  ~BackgroundValidator() { wait(); }
+
+  // poem is the number of poems trained on when the snapshot was taken
+  void submit(Checkpoint snapshot, size_t poem) {
+    wait();
+    lastPoem = poem;
+    pending = std::async(std::launch::async, [this, poem,
+                                              snapshot = std::move(
+                                                  snapshot)]() mutable {
+      TRACE_SCOPE("validate");
+      CustomNetModel model(snapshot);
+      CustomNetModel::Workspace workspace = model.make_workspace();
+      double avg = 0.0;
+      for (const string32_t &s : valCorpus) {
+        avg += std::log2(perplexity(model, s, workspace));
+      }
+      return Result{poem, std::exp2(avg / valCorpus.size()),
+                    std::move(snapshot)};
+    });
+  }
+
+  void wait() {
+    if (!pending.valid()) {
+      return;
+    }
+    Result result = pending.get();
+    bool improved = result.perplexity < bestPerplexity;
+    std::cerr << "validation after " << result.poem << " poems: perplexity "
+              << result.perplexity << (improved ? " (best)" : "")
+              << std::endl;
+    if (improved) {
+      bestPerplexity = result.perplexity;
+      bestPoem = result.poem;
+      best = std::move(result.snapshot);
+      sinceBest = 0;
+    } else {
+      sinceBest++;
+    }
+  }
+
+  bool should_stop() const { return patience && sinceBest >= patience; }
+  size_t last_poem() const { return lastPoem; }
+  size_t best_poem() const { return bestPoem; }
+  double best_perplexity() const { return bestPerplexity; }
+  const Checkpoint &best_snapshot() const { return best; }
+
+private:
+  struct Result {
+    size_t poem;
+    double perplexity;
+    Checkpoint snapshot;
+  };
+
+  const corpus_t &valCorpus;
+  size_t patience;
+  std::future<Result> pending;
+  Checkpoint best;
+  double bestPerplexity;
+  size_t bestPoem;
+  size_t lastPoem;
+  size_t sinceBest;
+};
+
+// Samples one string of at most maxLen symbols, drawing from rng.
+template <class M>
+string32_t sample(M &model, size_t maxLen, Philox &rng,
+                  typename M::Workspace &workspace,
+                  DistributionCache<M> *cache = nullptr) {
   using State = typename M::State;
-  std::uniform_real_distribution distribution;
-  std::default_random_engine generator(
-      std::chrono::system_clock::now().time_since_epoch().count());
   string32_t out;
   State state = model.start();
   for (size_t i = 0; i < maxLen; i++) {
-    auto probs = model.probs(state);
-    double randN = distribution(generator);
-    auto randIt = probs.begin();
-    while ((randN -= randIt->second) > 0) {
-      randIt++;
+    const std::vector<double> &probs =
+        cache ? cache->probs(state, workspace) : model.probs(state, workspace);
+    double randN = rng.uniform();
+    uint32_t j = 0;
+    while ((randN -= probs[j]) > 0 && j + 1 < probs.size()) {
+      j++;
     }
-    char32_t c = randIt->first;
+    char32_t c = model.get_alphabet().deserialize(j);
     if (c == utf::END_STRING) {
       break;
     } else {
@@ -106,55 +369,585 @@ template <class M> string32_t generate_random(M &model, size_t maxLen) {
   return out;
 }
 
-corpus_t load_corpus(const std::string &filepath,
-                     string32_t delim = U"\n#SEP#\n") {
-  string32_t s;
-  {
-    std::ifstream ifs;
-    ifs.open(filepath);
-    assert(ifs.is_open());
-    char32_t codePoint;
-    sstream32_t ss;
-    while ((codePoint = utf::read_utf8(ifs)) != utf::END_STREAM) {
-      utf::write_utf32(codePoint, ss);
+// Stream 0 of seed, i.e. the first sample generate_batch() would draw.
+template <class M>
+string32_t generate_random(M &model, size_t maxLen, uint64_t seed,
+                           DistributionCache<M> *cache = nullptr) {
+  TRACE_SCOPE("generate");
+  typename M::Workspace workspace = model.make_workspace();
+  Philox rng(seed, 0);
+  return sample(model, maxLen, rng, workspace, cache);
+}
+
+// Draws nSamples independent samples on nThreads threads. Sample i always
+// comes from Philox stream (seed, i), so the batch is the same for any
+// thread count.
+template <class M>
+std::vector<string32_t> generate_batch(const M &model, size_t nSamples,
+                                       size_t maxLen, uint64_t seed,
+                                       size_t nThreads) {
+  TRACE_SCOPE("generate_batch");
+  nThreads = std::max<size_t>(nThreads, 1);
+  ThreadPool pool(nThreads);
+  std::vector<string32_t> samples(nSamples);
+  std::atomic<size_t> next(0);
+  Progress pbar(nSamples, "generate");
+  pool.run(nThreads, [&](size_t) {
+    typename M::Workspace workspace = model.make_workspace();
+    for (size_t i; (i = next++) < nSamples;) {
+      Philox rng(seed, i);
+      samples[i] = sample(model, maxLen, rng, workspace);
+      pbar.add(1, samples[i].size());
     }
-    ifs.close();
-    s = ss.str();
+  });
+  return samples;
+}
+
+// Writes one sample of at most maxLen symbols to out.txt, then scores the
+// test set on nThreads threads, reporting the speed of both to stderr. With
+// cacheSize, each caches that many distributions per thread. Returns the
+// test-set perplexity.
+template <class M>
+double sample_and_score(const M &model, size_t nThreads, uint64_t seed,
+                        size_t maxLen, size_t cacheSize) {
+  std::unique_ptr<DistributionCache<const M>> cache;
+  if (cacheSize) {
+    cache = std::make_unique<DistributionCache<const M>>(model, cacheSize);
   }
+  auto begin = std::chrono::steady_clock::now();
+  string32_t s = generate_random(model, maxLen, seed, cache.get());
+  double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - begin)
+          .count();
+  std::cerr << "generated " << s.size() << " chars in " << seconds << " s ("
+            << s.size() / seconds << " chars/s)" << std::endl;
+  if (cache) {
+    std::cerr << "generate cache: " << cache->hit_rate() * 100.0 << "% hits"
+              << std::endl;
+  }
+  ofstream8_t ofs;
+  ofs.open("out.txt");
+  utf::Utf8Writer(ofs).write(s);
+  ofs.close();
 
-  std::vector<string32_t> out;
-  {
-    size_t oldPos = 0;
-    size_t newPos = 0;
-    while ((newPos = s.find(delim, oldPos)) != string32_t::npos) {
-      out.push_back(s.substr(oldPos, newPos - oldPos));
-      oldPos = newPos + delim.size();
-    }
-    out.push_back(s.substr(oldPos, s.size() - oldPos));
+  corpus_t testCorpus = load_corpus("data/test.txt");
+  size_t nTestChars = 0;
+  for (const string32_t &poem : testCorpus) {
+    nTestChars += poem.size() + 1;
   }
+  begin = std::chrono::steady_clock::now();
+  double result = perplexity(model, testCorpus, std::max<size_t>(nThreads, 1),
+                             cacheSize);
+  seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - begin)
+          .count();
+  std::cerr << "scored " << nTestChars << " chars in " << seconds << " s ("
+            << nTestChars / seconds << " chars/s)" << std::endl;
+  return result;
+}
 
-  return out;
+// Writes one sample of the saved transformer at path to out.txt and returns
+// its test-set perplexity.
+double run_transformer(const std::string &path, size_t nThreads,
+                       uint64_t seed, size_t maxLen, size_t cacheSize) {
+  auto begin = std::chrono::steady_clock::now();
+  const TransformerModel model(path);
+  std::cerr << "loaded " << path << " ("
+            << format_bytes(model.memory_usage().total().bytes) << ") in "
+            << std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - begin)
+                   .count()
+            << " ms" << std::endl;
+
+  return sample_and_score(model, nThreads, seed, maxLen, cacheSize);
 }
 
-Alphabet<> get_corpus_alphabet(const corpus_t &corpus) {
+// Counts the order-5 n-grams of the training file at trainPath into the file
+// at path without loading the corpus, keeping within memoryBudget bytes, then
+// writes one sample to out.txt and returns the test-set perplexity of the
+// model served from that file.
+double run_external_ngram(const std::string &trainPath,
+                          const std::string &path, size_t memoryBudget,
+                          size_t nThreads, uint64_t seed, size_t maxLen,
+                          size_t cacheSize) {
+  auto begin = std::chrono::steady_clock::now();
   std::unordered_set<char32_t> letters;
-  for (const string32_t s : corpus) {
-    letters.insert(s.cbegin(), s.cend());
+  for_each_poem(trainPath, [&](const string32_t &s) {
+    letters.insert(s.begin(), s.end());
+  });
+  return dispatch_window(4, [&](auto window) {
+    using W = decltype(window);
+    {
+      ExternalNGramCounter<W> counter(5, Alphabet<>(letters), path,
+                                      memoryBudget);
+      for_each_poem(trainPath, [&](const string32_t &s) {
+        W state = counter.start();
+        for (char32_t c : s + utf::END_STRING) {
+          counter.observe(state, c);
+          state = counter.step(state, c);
+        }
+      });
+      size_t bytes = counter.write();
+      double seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - begin)
+                           .count();
+      std::cerr << "counted " << counter.n_observed() << " chars in "
+                << counter.n_runs() << " runs, wrote " << format_bytes(bytes)
+                << " to " << path << " in " << seconds << " s ("
+                << counter.n_observed() / seconds << " chars/s)" << std::endl;
+    }
+
+    const DiskNGramModel<W> model(path);
+    return sample_and_score(model, nThreads, seed, maxLen, cacheSize);
+  });
+}
+
+// Indexes trainCorpus in a SuffixArrayModel, writes one sample to out.txt
+// and returns the test-set perplexity.
+double run_suffix_array(const corpus_t &trainCorpus,
+                        const Alphabet<> &alphabet, size_t minCount,
+                        size_t nThreads, uint64_t seed, size_t maxLen,
+                        size_t cacheSize) {
+  auto begin = std::chrono::steady_clock::now();
+  const SuffixArrayModel model(trainCorpus, alphabet, minCount);
+  size_t bytes = model.memory_usage().total().bytes;
+  std::cerr << "indexed " << model.size() << " symbols ("
+            << format_bytes(bytes) << ", "
+            << (double)bytes / model.size() << " bytes/symbol) in "
+            << std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - begin)
+                   .count()
+            << " ms" << std::endl;
+
+  return sample_and_score(model, nThreads, seed, maxLen, cacheSize);
+}
+
+// Ingests trainCorpus into an OnlineNGramModel on this thread while nReaders
+// threads keep scoring valCorpus against it, then reports the readers'
+// per-query latency.
+void online_benchmark(const corpus_t &trainCorpus, const corpus_t &valCorpus,
+                      const Alphabet<> &alphabet, size_t nReaders) {
+  using Clock = std::chrono::steady_clock;
+  OnlineNGramModel model(5, alphabet, 10000);
+  std::atomic<bool> ingesting(true);
+  std::vector<std::vector<double>> latencies(nReaders);
+  std::vector<std::thread> readers;
+  for (size_t r = 0; r < nReaders; r++) {
+    readers.emplace_back([&, r]() {
+      OnlineNGramModel::Reader reader(model);
+      OnlineNGramModel::Workspace workspace = model.make_workspace();
+      std::vector<double> &out = latencies[r];
+      out.reserve(1 << 20);
+      for (size_t i = r; ingesting.load(); i++) {
+        const string32_t &s = valCorpus[i % valCorpus.size()];
+        OnlineNGramModel::State state = model.start();
+        for (char32_t c : s) {
+          auto begin = Clock::now();
+          reader.logprob(state, c, workspace);
+          out.push_back(
+              std::chrono::duration<double, std::micro>(Clock::now() - begin)
+                  .count());
+          state = model.step(state, c);
+        }
+      }
+    });
+  }
+
+  auto begin = Clock::now();
+  size_t nChars = 0;
+  for (const string32_t &s : trainCorpus) {
+    OnlineNGramModel::State state = model.start();
+    for (char32_t c : s + utf::END_STRING) {
+      model.observe(state, c);
+      state = model.step(state, c);
+    }
+    nChars += s.size() + 1;
+  }
+  model.publish();
+  double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+  ingesting.store(false);
+  for (std::thread &reader : readers) {
+    reader.join();
+  }
+
+  std::vector<double> all;
+  for (const std::vector<double> &out : latencies) {
+    all.insert(all.end(), out.begin(), out.end());
+  }
+  std::sort(all.begin(), all.end());
+  auto quantile = [&](double q) {
+    return all.empty() ? 0.0 : all[(size_t)(q * (all.size() - 1))];
+  };
+  std::cout << "ingested " << nChars << " chars in " << seconds << " s ("
+            << nChars / seconds << " chars/s), " << model.version()
+            << " versions published" << std::endl;
+  std::cout << nReaders << " readers, " << all.size()
+            << " queries, latency us: p50 " << quantile(0.5) << ", p99 "
+            << quantile(0.99) << ", p99.9 " << quantile(0.999) << ", max "
+            << quantile(1.0) << std::endl;
+}
+
+// Trains one NGramModel of order maxOrder and scores valCorpus under every
+// (order, smoothing) pair in a single pass, since the order-maxOrder trie
+// holds the counts of every lower order. Prints the pairs ranked by
+// perplexity, computed as perplexity() does.
+void sweep_ngram(const corpus_t &trainCorpus, const corpus_t &valCorpus,
+                 const Alphabet<> &alphabet, size_t maxOrder,
+                 const std::vector<double> &smoothings, size_t nThreads) {
+  NGramModel model(maxOrder, alphabet);
+  dispatch_window(maxOrder - 1, [&](auto empty) {
+    using W = decltype(empty);
+    for (const string32_t &s : trainCorpus) {
+      W window = model.start_window<W>();
+      for (char32_t c : s + utf::END_STRING) {
+        model.observe(window, c);
+        window = model.slide(window, c);
+      }
+      model.finish(window);
+    }
+  });
+  model.link();
+
+  const size_t nConfigs = maxOrder * smoothings.size();
+  const double nSymbols = alphabet.size();
+  std::vector<double> logPerplexities(valCorpus.size() * nConfigs);
+  std::atomic<size_t> next(0);
+  ThreadPool pool(nThreads);
+  Progress pbar(valCorpus.size(), "sweep");
+  pool.run(nThreads, [&](size_t) {
+    std::vector<NGramModel::Evidence> evidence(maxOrder);
+    for (size_t i; (i = next++) < valCorpus.size();) {
+      double *out = &logPerplexities[i * nConfigs];
+      NGramModel::State state = model.start();
+      for (char32_t c : valCorpus[i] + utf::END_STRING) {
+        model.evidence(state, c, evidence.data());
+        for (size_t k = 0; k < maxOrder; k++) {
+          const NGramModel::Evidence &e = evidence[k];
+          for (size_t a = 0; a < smoothings.size(); a++) {
+            double alpha = smoothings[a];
+            out[k * smoothings.size() + a] -=
+                std::log2((e.count + alpha) / (e.total + alpha * nSymbols));
+          }
+        }
+        state = model.step(state, c);
+      }
+      for (size_t j = 0; j < nConfigs; j++) {
+        out[j] /= valCorpus[i].size() + 1;
+      }
+      pbar.add(1, valCorpus[i].size() + 1);
+    }
+  });
+
+  struct Result {
+    size_t order;
+    double smoothing;
+    double perplexity;
+  };
+  std::vector<Result> results;
+  for (size_t j = 0; j < nConfigs; j++) {
+    double avg = 0.0;
+    for (size_t i = 0; i < valCorpus.size(); i++) {
+      avg += logPerplexities[i * nConfigs + j];
+    }
+    results.push_back(Result{j / smoothings.size() + 1,
+                             smoothings[j % smoothings.size()],
+                             std::exp2(avg / valCorpus.size())});
+  }
+  std::stable_sort(results.begin(), results.end(),
+                   [](const Result &a, const Result &b) {
+                     return a.perplexity < b.perplexity;
+                   });
+  std::cout << std::setw(4) << "rank" << std::setw(7) << "order"
+            << std::setw(12) << "smoothing" << std::setw(14) << "perplexity"
+            << std::endl;
+  for (size_t r = 0; r < results.size(); r++) {
+    std::cout << std::setw(4) << r + 1 << std::setw(7) << results[r].order
+              << std::setw(12) << results[r].smoothing << std::setw(14)
+              << results[r].perplexity << std::endl;
   }
-  return Alphabet<>(letters);
 }
 
 int main(int argc, char *argv[]) {
-  corpus_t trainCorpus = load_corpus("data/train.txt");
+  std::string trainPath = "data/train.txt";
+  size_t nThreads = 0;
+  std::string checkpointPath;
+  size_t checkpointEvery = 1000;
+  std::string resumePath;
+  size_t nOnlineReaders = 0;
+  uint64_t seed = std::chrono::system_clock::now().time_since_epoch().count();
+  bool seeded = false;
+  std::string reportPath;
+  std::string baselinePath;
+  double tolerance = 0.1;
+  std::string tracePath;
+  size_t validateEvery = 0;
+  size_t patience = 3;
+  size_t nValidatePoems = 0;
+  size_t sweepOrder = 0;
+  size_t suffixArrayMinCount = 0;
+  size_t nBpeMerges = 0;
+  bool backgroundGrowth = false;
+  std::string externalNGramPath;
+  size_t memoryBudget = ExternalNGramSorter::DEFAULT_MEMORY_BUDGET;
+  size_t cacheSize = 0;
+  size_t beamWidth = 0;
+  size_t nSamples = 0;
+  std::string transformerPath;
+  size_t sampleLength = 2000;
+  double lengthPenalty = 0.6;
+  std::vector<double> sweepSmoothings = {1e-4, 3e-4, 1e-3, 3e-3, 1e-2,
+                                         3e-2, 1e-1, 3e-1, 1.0};
+  trace::Level traceLevel = trace::Level::COARSE;
+  CustomNetModel::PruneConfig pruneConfig{0.0, 0, 50000, 10};
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--train" && i + 1 < argc) {
+      trainPath = argv[++i];
+    } else if (arg == "--threads" && i + 1 < argc) {
+      nThreads = std::stoul(argv[++i]);
+    } else if (arg == "--checkpoint" && i + 1 < argc) {
+      checkpointPath = argv[++i];
+    } else if (arg == "--checkpoint-every" && i + 1 < argc) {
+      checkpointEvery = std::max<size_t>(std::stoul(argv[++i]), 1);
+    } else if (arg == "--resume" && i + 1 < argc) {
+      resumePath = argv[++i];
+    } else if (arg == "--progress" && i + 1 < argc) {
+      Progress::set_mode(Progress::parse_mode(argv[++i]));
+    } else if (arg == "--progress-interval" && i + 1 < argc) {
+      Progress::set_interval(std::chrono::milliseconds(std::stoul(argv[++i])));
+    } else if (arg == "--online" && i + 1 < argc) {
+      nOnlineReaders = std::max<size_t>(std::stoul(argv[++i]), 1);
+    } else if (arg == "--seed" && i + 1 < argc) {
+      seed = std::stoull(argv[++i]);
+      seeded = true;
+    } else if (arg == "--report" && i + 1 < argc) {
+      reportPath = argv[++i];
+    } else if (arg == "--baseline" && i + 1 < argc) {
+      baselinePath = argv[++i];
+    } else if (arg == "--tolerance" && i + 1 < argc) {
+      tolerance = std::stod(argv[++i]);
+    } else if (arg == "--trace" && i + 1 < argc) {
+      tracePath = argv[++i];
+    } else if (arg == "--trace-detail") {
+      traceLevel = trace::Level::FINE;
+    } else if (arg == "--validate-every" && i + 1 < argc) {
+      validateEvery = std::stoul(argv[++i]);
+    } else if (arg == "--patience" && i + 1 < argc) {
+      patience = std::stoul(argv[++i]);
+    } else if (arg == "--validate-poems" && i + 1 < argc) {
+      nValidatePoems = std::stoul(argv[++i]);
+    } else if (arg == "--sweep" && i + 1 < argc) {
+      sweepOrder = std::max<size_t>(std::stoul(argv[++i]), 1);
+    } else if (arg == "--sweep-smoothing" && i + 1 < argc) {
+      sweepSmoothings.clear();
+      std::stringstream ss(argv[++i]);
+      std::string value;
+      while (std::getline(ss, value, ',')) {
+        sweepSmoothings.push_back(std::stod(value));
+      }
+    } else if (arg == "--suffix-array" && i + 1 < argc) {
+      suffixArrayMinCount = std::max<size_t>(std::stoul(argv[++i]), 1);
+    } else if (arg == "--bpe" && i + 1 < argc) {
+      nBpeMerges = std::stoul(argv[++i]);
+    } else if (arg == "--external-ngram" && i + 1 < argc) {
+      externalNGramPath = argv[++i];
+    } else if (arg == "--memory-budget" && i + 1 < argc) {
+      memoryBudget = std::stoul(argv[++i]) << 20;
+    } else if (arg == "--transformer" && i + 1 < argc) {
+      transformerPath = argv[++i];
+    } else if (arg == "--samples" && i + 1 < argc) {
+      nSamples = std::stoul(argv[++i]);
+    } else if (arg == "--sample-length" && i + 1 < argc) {
+      sampleLength = std::stoul(argv[++i]);
+    } else if (arg == "--beam" && i + 1 < argc) {
+      beamWidth = std::stoul(argv[++i]);
+    } else if (arg == "--length-penalty" && i + 1 < argc) {
+      lengthPenalty = std::stod(argv[++i]);
+    } else if (arg == "--cache" && i + 1 < argc) {
+      cacheSize = std::stoul(argv[++i]);
+    } else if (arg == "--max-combos" && i + 1 < argc) {
+      pruneConfig.maxCombos = std::stoul(argv[++i]);
+    } else if (arg == "--min-info" && i + 1 < argc) {
+      pruneConfig.minMutualInfo = std::stod(argv[++i]);
+    } else if (arg == "--background-growth") {
+      backgroundGrowth = true;
+    }
+  }
+
+  // only the custom model trains on tokens
+  if (nBpeMerges && (!transformerPath.empty() || !externalNGramPath.empty() ||
+                     sweepOrder || suffixArrayMinCount || nOnlineReaders)) {
+    std::cerr << "--bpe cannot be combined with --transformer, "
+                 "--external-ngram, --sweep, --suffix-array or --online"
+              << std::endl;
+    return 1;
+  }
+
+  if (!tracePath.empty()) {
+    trace::start(traceLevel);
+  }
+
+  // Runs that produce a report are compared against each other, so they must
+  // not depend on the clock.
+  bool harness = !reportPath.empty() || !baselinePath.empty();
+  if (harness && !seeded) {
+    seed = 0;
+  }
+  PerfReport report;
+  auto phaseBegin = std::chrono::steady_clock::now();
+  auto end_phase = [&](const std::string &phase, size_t nChars) {
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - phaseBegin).count();
+    report.set(phase + ".seconds", seconds);
+    if (nChars) {
+      report.set(phase + ".chars_per_s", nChars / seconds);
+    }
+    phaseBegin = now;
+  };
+
+  // estimates per structure, checked against the heap when counting
+  auto end_memory = [&](const std::string &phase, const MemoryUsage &usage) {
+    std::cerr << "memory after " << phase << ":\n" << usage.describe();
+    report.set("memory." + phase + "_bytes", usage.total().bytes);
+    if (alloc_counting_enabled()) {
+      std::cerr << "  heap in use " << format_bytes(alloc_live_bytes())
+                << std::endl;
+      report.set("heap." + phase + "_bytes", alloc_live_bytes());
+    }
+  };
+
+  // Every mode ends here: writes the trace and the report, and compares the
+  // report against the baseline. Returns the exit status.
+  auto finish = [&]() {
+    if (!tracePath.empty()) {
+      size_t nEvents = trace::write(tracePath);
+      std::cerr << "trace: " << nEvents << " events written to " << tracePath
+                << std::endl;
+    }
+    if (harness) {
+      report.set("seed", (double)seed);
+      report.set("threads", nThreads);
+      report.set("peak_rss_kb", peak_rss_kb());
+    }
+    if (!reportPath.empty()) {
+      report.write(reportPath);
+    }
+    if (!baselinePath.empty()) {
+      bool ok = report.compare(PerfReport::read(baselinePath), tolerance,
+                               std::cerr);
+      if (!ok) {
+        std::cerr << "regressions against " << baselinePath << " (tolerance "
+                  << tolerance * 100.0 << "%)" << std::endl;
+        return 2;
+      }
+    }
+    return 0;
+  };
+
+  if (!transformerPath.empty()) {
+    double result = run_transformer(transformerPath, nThreads, seed,
+                                    sampleLength, cacheSize);
+    std::cout << result << std::endl;
+    report.set("perplexity", result);
+    return finish();
+  }
+
+  if (!externalNGramPath.empty()) {
+    double result = run_external_ngram(trainPath, externalNGramPath,
+                                       memoryBudget, nThreads, seed,
+                                       sampleLength, cacheSize);
+    std::cout << result << std::endl;
+    report.set("perplexity", result);
+    return finish();
+  }
+
+  corpus_t trainCorpus = load_corpus(trainPath);
   corpus_t valCorpus = load_corpus("data/validate.txt");
   Alphabet<> alphabet = get_corpus_alphabet(trainCorpus);
+  size_t nTrainChars = 0;
+  for (const string32_t &s : trainCorpus) {
+    nTrainChars += s.size() + 1;
+  }
+  end_phase("load", 0);
+  MemoryUsage corpusUsage;
+  corpusUsage.add("trainCorpus", corpus_memory_usage(trainCorpus));
+  corpusUsage.add("valCorpus", corpus_memory_usage(valCorpus));
+  end_memory("load", corpusUsage);
   for (size_t i = 0; i < alphabet.size(); i++) {
     char32_t c = alphabet.deserialize(i);
     std::cout << i << ' ' << c << ' ';
     utf::write_utf8(c, std::cout);
     std::cout << std::endl;
   }
-  CustomNetModel model(16, alphabet);
+  if (sweepOrder) {
+    sweep_ngram(trainCorpus, valCorpus, alphabet, sweepOrder, sweepSmoothings,
+                std::max<size_t>(nThreads, 1));
+    return finish();
+  }
+  if (suffixArrayMinCount) {
+    double result = run_suffix_array(trainCorpus, alphabet,
+                                     suffixArrayMinCount, nThreads, seed,
+                                     sampleLength, cacheSize);
+    std::cout << result << std::endl;
+    report.set("perplexity", result);
+    return finish();
+  }
+  if (nOnlineReaders) {
+    online_benchmark(trainCorpus, valCorpus, alphabet, nOnlineReaders);
+    return finish();
+  }
+
+  // the model trains and validates on tokens; output is decoded and the test
+  // set is scored per character
+  std::unique_ptr<BpeTokenizer> tokenizer;
+  if (nBpeMerges) {
+    auto begin = std::chrono::steady_clock::now();
+    tokenizer = std::make_unique<BpeTokenizer>(trainCorpus, nBpeMerges);
+    trainCorpus = tokenizer->encode(trainCorpus);
+    valCorpus = tokenizer->encode(valCorpus);
+    alphabet = get_corpus_alphabet(trainCorpus);
+    size_t nTokens = 0;
+    for (const string32_t &s : trainCorpus) {
+      nTokens += s.size() + 1;
+    }
+    std::cerr << "bpe: " << tokenizer->n_merges() << " merges in "
+              << std::chrono::duration<double>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count()
+              << " s, " << alphabet.size() << " symbols, "
+              << (double)nTokens / nTrainChars << " tokens per char"
+              << std::endl;
+    corpusUsage.add("tokenizer", tokenizer->memory_usage());
+  }
+  // A model on tokens draws maxLen tokens, which decode to more characters,
+  // so the text is cut back to maxLen characters.
+  auto decode = [&](const string32_t &s, size_t maxLen) {
+    return tokenizer ? tokenizer->decode(s).substr(0, maxLen) : s;
+  };
+
+  if (!resumePath.empty() && backgroundGrowth) {
+    // A checkpoint does not hold the ranking being searched, so a resumed run
+    // would grow differently from one that was never interrupted.
+    std::cerr << "--resume cannot be combined with --background-growth"
+              << std::endl;
+    return 1;
+  }
+  Checkpoint resumed{};
+  if (!resumePath.empty()) {
+    auto begin = std::chrono::steady_clock::now();
+    resumed = read_checkpoint(resumePath);
+    std::cerr << "loaded " << resumePath << " ("
+              << resumed.combos.size() << " combos) in "
+              << std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count()
+              << " ms" << std::endl;
+  }
+  phaseBegin = std::chrono::steady_clock::now();
+  CustomNetModel model = resumePath.empty() ? CustomNetModel(16, alphabet)
+                                            : CustomNetModel(resumed);
+  model.set_prune_config(pruneConfig);
+  model.set_background_growth(backgroundGrowth);
   // model.add_combo_node(6, U'e', 7, U' ');
   // model.add_combo_node(6, U't', 7, U' ');
   // model.add_combo_node(6, U'e', 7, U'a');
@@ -166,20 +959,241 @@ int main(int argc, char *argv[]) {
   // model.add_combo_node(6, U'x', 7, U' ');
   // model.add_combo_node(6, U'x', 7, U'k');
   // NGramModel model(5, get_corpus_alphabet(trainCorpus));
-  train(model, trainCorpus, valCorpus);
+
+  // checkpoints are snapshotted on the training thread and written behind it
+  CheckpointWriter checkpointWriter;
+  double snapshotMs = 0.0;
+  bool saved = false;
+  size_t savedCombos = 0;
+  auto save = [&](const std::vector<uint64_t> &cursor) {
+    saved = true;
+    auto begin = std::chrono::steady_clock::now();
+    Checkpoint checkpoint;
+    {
+      TRACE_SCOPE("snapshot_checkpoint");
+      checkpoint = model.checkpoint(cursor);
+    }
+    snapshotMs = std::chrono::duration<double, std::milli>(
+                     std::chrono::steady_clock::now() - begin)
+                     .count();
+    savedCombos = checkpoint.combos.size();
+    checkpointWriter.write(std::move(checkpoint), checkpointPath);
+  };
+
+  corpus_t validateCorpus(
+      valCorpus.begin(),
+      valCorpus.begin() + (nValidatePoems ? std::min(nValidatePoems,
+                                                     valCorpus.size())
+                                          : valCorpus.size()));
+  BackgroundValidator validator(validateCorpus, patience);
+  auto validate = [&](const std::vector<uint64_t> &cursor, size_t poem) {
+    Checkpoint snapshot;
+    {
+      TRACE_SCOPE("snapshot_validation");
+      snapshot = model.checkpoint(cursor);
+    }
+    validator.submit(std::move(snapshot), poem);
+    return !validator.should_stop();
+  };
+
+  size_t trained;
+  std::vector<uint64_t> lastCursor;
+  if (nThreads) {
+    if (!resumed.cursor.empty() && resumed.cursor.size() != 1 + 3 * nThreads) {
+      std::cerr << "checkpoint was not written with --threads " << nThreads
+                << std::endl;
+      return 1;
+    }
+    size_t lastSaved = 0;
+    size_t lastValidated = 0;
+    trained = 0;
+    train_parallel(model, trainCorpus, nThreads, resumed.cursor,
+                   [&](const std::vector<uint64_t> &cursor) {
+                     size_t finished = 0;
+                     bool done = true;
+                     for (size_t w = 0; w < nThreads; w++) {
+                       finished += cursor[3 + 3 * w];
+                       done = done && cursor[1 + 3 * w] >= trainCorpus.size();
+                     }
+                     trained = finished;
+                     lastCursor = cursor;
+                     if (!checkpointPath.empty() &&
+                         (finished / checkpointEvery > lastSaved || done)) {
+                       lastSaved = finished / checkpointEvery;
+                       save(cursor);
+                     }
+                     if (validateEvery &&
+                         finished / validateEvery > lastValidated) {
+                       lastValidated = finished / validateEvery;
+                       return validate(cursor, finished);
+                     }
+                     return true;
+                   });
+  } else {
+    if (resumed.cursor.size() > 1) {
+      std::cerr << "checkpoint was written by parallel training" << std::endl;
+      return 1;
+    }
+    size_t begin = resumed.cursor.empty() ? 0 : resumed.cursor[0];
+    trained = train(model, trainCorpus, begin, [&](size_t next) {
+      if (!checkpointPath.empty() &&
+          (next % checkpointEvery == 0 || next == trainCorpus.size())) {
+        save({next});
+      }
+      if (validateEvery && next % validateEvery == 0) {
+        return validate({next}, next);
+      }
+      return true;
+    });
+    lastCursor = {trained};
+  }
+  // wait for the last search rather than leave it running alongside
+  // generation, testing and the trace
+  model.set_background_growth(false);
+  if (validateEvery) {
+    // score the final model too, then fall back to the best snapshot
+    if (validator.last_poem() != trained) {
+      validate(lastCursor, trained);
+    }
+    validator.wait();
+    if (trained < trainCorpus.size()) {
+      std::cerr << "stopped early after " << trained << " poems" << std::endl;
+      if (!checkpointPath.empty()) {
+        save(lastCursor);
+      }
+    }
+    if (validator.best_poem() != trained) {
+      std::cerr << "restoring the model after " << validator.best_poem()
+                << " poems (validation perplexity "
+                << validator.best_perplexity() << ")" << std::endl;
+      model = CustomNetModel(validator.best_snapshot());
+      model.set_prune_config(pruneConfig);
+    }
+    if (!checkpointPath.empty()) {
+      write_checkpoint(validator.best_snapshot(), checkpointPath + ".best");
+    }
+    report.set("validation.best_poem", validator.best_poem());
+    report.set("validation.perplexity", validator.best_perplexity());
+  }
+  model.refresh_caches();
+  end_phase("train", nTrainChars);
+  report.set("combos", model.n_combos());
+  MemoryUsage usage = corpusUsage;
+  usage.add("model", model.memory_usage());
+  end_memory("train", usage);
+  if (saved) {
+    checkpointWriter.wait();
+    std::cerr << "checkpoint " << checkpointPath << ": " << savedCombos
+              << " combos, " << checkpointWriter.last_bytes()
+              << " bytes, snapshot " << snapshotMs << " ms, write "
+              << checkpointWriter.last_seconds() * 1000.0 << " ms"
+              << std::endl;
+  }
 
   {
-    string32_t s = generate_random(model, 30000);
+    phaseBegin = std::chrono::steady_clock::now();
+    std::unique_ptr<DistributionCache<CustomNetModel>> cache;
+    if (cacheSize) {
+      cache = std::make_unique<DistributionCache<CustomNetModel>>(model,
+                                                                  cacheSize);
+    }
+    string32_t s =
+        decode(generate_random(model, 30000, seed, cache.get()), 30000);
+    if (cache) {
+      std::cerr << "generate cache: " << cache->hit_rate() * 100.0
+                << "% hits" << std::endl;
+    }
+    end_phase("generate", s.size());
+    report.set("generate.chars", s.size());
+    MemoryUsage usage = corpusUsage;
+    usage.add("model", model.memory_usage());
+    usage.add("generated", memory::of(s));
+    end_memory("generate", usage);
     ofstream8_t ofs;
     ofs.open("out.txt");
     // model.desc_input(ofs);
     // model.desc_combo(ofs, 1);
-    for (char32_t c : s) {
-      utf::write_utf8(c, ofs);
+    utf::Utf8Writer(ofs).write(s);
+    ofs.close();
+  }
+
+  if (nSamples) {
+    phaseBegin = std::chrono::steady_clock::now();
+    std::vector<string32_t> samples =
+        generate_batch((const CustomNetModel &)model, nSamples, sampleLength,
+                       seed, nThreads);
+    size_t nChars = 0;
+    {
+      ofstream8_t ofs;
+      ofs.open("samples.txt");
+      utf::Utf8Writer writer(ofs);
+      for (size_t i = 0; i < samples.size(); i++) {
+        if (i) {
+          writer.write(U"\n#SEP#\n");
+        }
+        string32_t sample = decode(samples[i], sampleLength);
+        writer.write(sample);
+        nChars += sample.size();
+      }
+    }
+    end_phase("samples", nChars);
+    report.set("samples.chars", nChars);
+    double seconds;
+    report.get("samples.seconds", seconds);
+    std::cerr << "generated " << nSamples << " samples (" << nChars
+              << " chars) in " << seconds << " s" << std::endl;
+  }
+
+  if (beamWidth) {
+    std::unique_ptr<ThreadPool> pool;
+    if (nThreads) {
+      pool = std::make_unique<ThreadPool>(nThreads);
     }
+    phaseBegin = std::chrono::steady_clock::now();
+    string32_t s =
+        decode(beam_search((const CustomNetModel &)model, 30000, beamWidth,
+                           lengthPenalty, pool.get()),
+               30000);
+    end_phase("beam", s.size());
+    report.set("beam.chars", s.size());
+    double seconds;
+    report.get("beam.seconds", seconds);
+    std::cerr << "beam search (width " << beamWidth << "): " << s.size()
+              << " chars in " << seconds * 1000.0 << " ms" << std::endl;
+    ofstream8_t ofs;
+    ofs.open("beam.txt");
+    utf::Utf8Writer(ofs).write(s);
     ofs.close();
   }
 
   corpus_t testCorpus = load_corpus("data/test.txt");
-  std::cout << perplexity(model, testCorpus) << std::endl;
-}
\ No newline at end of file
+  size_t nTestChars = 0;
+  for (const string32_t &s : testCorpus) {
+    nTestChars += s.size() + 1;
+  }
+  phaseBegin = std::chrono::steady_clock::now();
+  double result;
+  if (tokenizer) {
+    result = perplexity_per_char((const CustomNetModel &)model, *tokenizer,
+                                 testCorpus, std::max<size_t>(nThreads, 1),
+                                 cacheSize);
+  } else if (nThreads) {
+    auto begin = std::chrono::steady_clock::now();
+    result = perplexity((const CustomNetModel &)model, testCorpus, nThreads,
+                        cacheSize);
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - begin)
+                         .count();
+    std::cerr << "scored " << nTestChars << " chars on " << nThreads
+              << " threads in " << seconds << " s (" << nTestChars / seconds
+              << " chars/s)" << std::endl;
+  } else {
+    result = perplexity(model, testCorpus, cacheSize);
+  }
+  end_phase("perplexity", nTestChars);
+  usage.add("testCorpus", corpus_memory_usage(testCorpus));
+  end_memory("perplexity", usage);
+  std::cout << result << std::endl;
+  report.set("perplexity", result);
+  return finish();
+}
@@ -0,0 +1,67 @@
+#include "memory_usage.hpp"
+
+#include <iomanip>
+#include <sstream>
+
+void MemoryUsage::add(const std::string &name, const Footprint &footprint) {
+  for (Part &part : partList) {
+    if (part.name == name) {
+      part.footprint += footprint;
+      return;
+    }
+  }
+  partList.push_back(Part{name, footprint});
+}
+
+void MemoryUsage::add(const std::string &prefix, const MemoryUsage &usage) {
+  for (const Part &part : usage.partList) {
+    add(prefix + "." + part.name, part.footprint);
+  }
+}
+
+Footprint MemoryUsage::total() const {
+  Footprint out{0, 0};
+  for (const Part &part : partList) {
+    out += part.footprint;
+  }
+  return out;
+}
+
+const std::vector<MemoryUsage::Part> &MemoryUsage::parts() const {
+  return partList;
+}
+
+std::string MemoryUsage::describe() const {
+  std::vector<Part> sorted = partList;
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const Part &a, const Part &b) {
+                     return a.footprint.bytes > b.footprint.bytes;
+                   });
+  std::stringstream ss;
+  for (const Part &part : sorted) {
+    ss << "  " << std::left << std::setw(32) << part.name << std::right
+       << std::setw(12) << format_bytes(part.footprint.bytes);
+    if (part.footprint.slack) {
+      ss << " (" << format_bytes(part.footprint.slack) << " slack)";
+    }
+    ss << '\n';
+  }
+  Footprint sum = total();
+  ss << "  " << std::left << std::setw(32) << "total" << std::right
+     << std::setw(12) << format_bytes(sum.bytes) << " ("
+     << format_bytes(sum.slack) << " slack)\n";
+  return ss.str();
+}
+
+std::string format_bytes(size_t bytes) {
+  const char *units[] = {"B", "KiB", "MiB", "GiB"};
+  double value = (double)bytes;
+  size_t i = 0;
+  while (value >= 1024.0 && i + 1 < 4) {
+    value /= 1024.0;
+    i++;
+  }
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(i ? 2 : 0) << value << ' ' << units[i];
+  return ss.str();
+}
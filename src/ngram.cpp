@@ -1,40 +1,151 @@
 #include "ngram.hpp"
 
-NGramModel::NGramModel(size_t n, const Alphabet<char32_t, uint32_t> &alphabet)
-    : n(n), maps({std::unordered_map<uint32_t, Mappee>()}), alphabet(alphabet) {
-}
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
-typename NGramModel::State NGramModel::start() {
-  return State(n - 1, alphabet.serialize(utf::BEG_STRING));
-}
+NGramModel::NGramModel(size_t n, const Alphabet<char32_t, uint32_t> &alphabet,
+                       double smoothing)
+    : alphabet(alphabet), n(n), smoothing(smoothing), nObserved(0),
+      maps({std::unordered_map<uint32_t, Mappee>()}), nodes({Node{0, 0, 0}}),
+      workspace(make_workspace()) {}
 
-void NGramModel::observe(State state, char32_t c) {
-  state.push_back(alphabet.serialize(c));
+void NGramModel::observe_window(const uint32_t *window, char32_t c) {
+  nObserved++;
   size_t i = 0;
-  for (size_t j = 0; j < state.size(); j++) {
-    uint32_t sc = state[j];
+  for (size_t j = 0; j < n; j++) {
+    uint32_t sc = j + 1 < n ? window[j] : alphabet.serialize(c);
     auto result = maps[i].insert(std::make_pair(sc, Mappee{0, 0}));
     result.first->second.count++;
+    size_t parent = i;
     i = result.first->second.next;
-    if (!i && j != state.size() - 1) {
+    if (!i && j != n - 1) {
       i = result.first->second.next = maps.size();
       maps.push_back(Map());
+      nodes.push_back(Node{(uint32_t)parent, sc, (uint32_t)j + 1});
+    }
+  }
+}
+
+// Links are set shallowest first, since a node's link is found by following
+// its parent's, and node ids need not be in depth order.
+void NGramModel::link() {
+  std::vector<uint32_t> byDepth(maps.size());
+  std::vector<size_t> firstOfDepth(n + 1, 0);
+  for (const Node &node : nodes) {
+    firstOfDepth[node.depth + 1]++;
+  }
+  for (size_t d = 1; d <= n; d++) {
+    firstOfDepth[d] += firstOfDepth[d - 1];
+  }
+  for (uint32_t id = 0; id < nodes.size(); id++) {
+    byDepth[firstOfDepth[nodes[id].depth]++] = id;
+  }
+
+  links.assign(maps.size(), 0);
+  for (uint32_t id : byDepth) {
+    const Node &node = nodes[id];
+    if (node.depth <= 1) {
+      continue;
+    }
+    uint32_t candidate = links[node.parent];
+    while (true) {
+      auto result = maps[candidate].find(node.symbol);
+      if (result != maps[candidate].end() && result->second.next) {
+        links[id] = (uint32_t)result->second.next;
+        break;
+      }
+      if (!candidate) {
+        break;
+      }
+      candidate = links[candidate];
+    }
+  }
+}
+
+// Without links the longest proper suffix that is a context is found by
+// walking each suffix of the node's string from the root, longest first.
+uint32_t NGramModel::suffix_link(uint32_t node) const {
+  if (links.size() == maps.size()) {
+    return links[node];
+  }
+  std::vector<uint32_t> symbols;
+  for (uint32_t id = node; id; id = nodes[id].parent) {
+    symbols.push_back(nodes[id].symbol);
+  }
+  std::reverse(symbols.begin(), symbols.end());
+  for (size_t begin = 1; begin < symbols.size(); begin++) {
+    size_t id = 0;
+    for (size_t j = begin; j < symbols.size() && id != maps.size(); j++) {
+      auto result = maps[id].find(symbols[j]);
+      id = result == maps[id].end() || !result->second.next
+               ? maps.size()
+               : result->second.next;
+    }
+    if (id != maps.size()) {
+      return (uint32_t)id;
     }
   }
+  return 0;
 }
 
-typename NGramModel::State NGramModel::step(State state, char32_t c) {
-  state.push_back(alphabet.serialize(c));
-  state.erase(state.begin());
+typename NGramModel::State NGramModel::start() const {
+  State state{0};
+  for (size_t k = 1; k < n; k++) {
+    state = step(state, utf::BEG_STRING);
+  }
   return state;
 }
 
+typename NGramModel::State NGramModel::step(State state, char32_t c) const {
+  const uint32_t sc = alphabet.serialize(c);
+  uint32_t node = state[0];
+  while (true) {
+    auto result = maps[node].find(sc);
+    if (result != maps[node].end() && result->second.next) {
+      return State{(uint32_t)result->second.next};
+    }
+    if (!node) {
+      return State{0};
+    }
+    node = suffix_link(node);
+  }
+}
+
 std::unordered_map<char32_t, double> NGramModel::probs(State state) {
-  std::vector<double> probs(alphabet.size(), 1.0 / alphabet.size());
+  const std::vector<double> &probs = this->probs(state, workspace);
+  std::unordered_map<char32_t, double> out;
+  for (uint32_t i = 0; i < probs.size(); i++) {
+    out.insert_or_assign(alphabet.deserialize(i), probs[i]);
+  }
+  return out;
+}
+
+typename NGramModel::Workspace NGramModel::make_workspace() const {
+  return Workspace{std::vector<double>(alphabet.size())};
+}
+
+const std::vector<double> &NGramModel::probs(const State &state,
+                                             Workspace &workspace) const {
+  fill_probs(maps[state[0]], workspace.ps);
+  return workspace.ps;
+}
+
+double NGramModel::logprob(const State &state, char32_t c,
+                           Workspace &) const {
+  const Map &map = maps[state[0]];
+  auto result = map.find(alphabet.serialize(c));
+  size_t count = result == map.end() ? 0 : result->second.count;
+  double denominator = (double)map_total(map) + smoothing * alphabet.size();
+  return std::log2(((double)count + smoothing) / denominator);
+}
+
+const std::vector<double> &NGramModel::probs(const Window &window,
+                                             Workspace &workspace) const {
   for (size_t i = 0; i < n; i++) {
-    Map *map = &maps[0];
+    const Map *map = &maps[0];
     for (size_t j = i; j < n - 1; j++) {
-      auto result = map->find(state[j]);
+      auto result = map->find(window[j]);
       if (result == map->end()) {
         map = nullptr;
         break;
@@ -43,25 +154,76 @@ std::unordered_map<char32_t, double> NGramModel::probs(State state) {
       }
     }
     if (map) {
-      size_t total = map_total(*map);
-      for (uint32_t j = 0; j < alphabet.size(); j++) {
-        auto result = map->find(j);
-        if (result == map->end()) {
-          probs[j] = 0.01 / ((double)total + 0.01 * alphabet.size());
-        } else {
-          probs[j] = ((double)result->second.count + 0.01) /
-                     ((double)total + 0.01 * alphabet.size());
-        }
-      }
+      fill_probs(*map, workspace.ps);
       break;
     }
   }
+  return workspace.ps;
+}
 
-  std::unordered_map<char32_t, double> out;
-  for (uint32_t i = 0; i < probs.size(); i++) {
-    out.insert_or_assign(alphabet.deserialize(i), probs[i]);
+double NGramModel::logprob(const Window &window, char32_t c,
+                           Workspace &workspace) const {
+  return std::log2(probs(window, workspace)[alphabet.serialize(c)]);
+}
+
+void NGramModel::fill_probs(const Map &map, std::vector<double> &probs) const {
+  probs.resize(alphabet.size());
+  size_t total = map_total(map);
+  double denominator = (double)total + smoothing * alphabet.size();
+  for (uint32_t j = 0; j < alphabet.size(); j++) {
+    auto result = map.find(j);
+    if (result == map.end()) {
+      probs[j] = smoothing / denominator;
+    } else {
+      probs[j] = ((double)result->second.count + smoothing) / denominator;
+    }
+  }
+}
+
+const Alphabet<char32_t, uint32_t> &NGramModel::get_alphabet() const {
+  return alphabet;
+}
+
+size_t NGramModel::get_n() const { return n; }
+
+double NGramModel::get_smoothing() const { return smoothing; }
+
+size_t NGramModel::context_size() const { return State().size(); }
+
+size_t NGramModel::revision() const { return nObserved; }
+
+// Backs off like probs(): order k uses the context of its last k - 1 symbols
+// if it was seen, and otherwise whatever order k - 1 used. The seen contexts
+// are the cursor and the nodes down its suffix links, one per order at most.
+// A k-gram's count is that of the k-prefix of the order-n windows, which is
+// exact once every sequence was finish()ed, except that the padding also
+// makes BEG_STRING follow runs of BEG_STRING; no real k-gram ends in
+// BEG_STRING, so those counts are left out of the totals.
+void NGramModel::evidence(const State &state, char32_t c,
+                          Evidence *out) const {
+  const size_t unseen = std::numeric_limits<size_t>::max();
+  uint32_t sc = alphabet.serialize(c);
+  uint32_t begin = alphabet.serialize(utf::BEG_STRING);
+  std::fill(out, out + n, Evidence{unseen, 0});
+  for (uint32_t node = state[0];; node = suffix_link(node)) {
+    const Map &map = maps[node];
+    auto result = map.find(sc);
+    auto padding = map.find(begin);
+    size_t total = map_total(map);
+    if (padding != map.end()) {
+      total -= padding->second.count;
+    }
+    out[nodes[node].depth] =
+        Evidence{result == map.end() ? 0 : result->second.count, total};
+    if (!node) {
+      break;
+    }
+  }
+  for (size_t k = 2; k <= n; k++) {
+    if (out[k - 1].count == unseen) {
+      out[k - 1] = out[k - 2];
+    }
   }
-  return out;
 }
 
 size_t NGramModel::map_total(const typename NGramModel::Map &map) {
@@ -70,4 +232,17 @@ size_t NGramModel::map_total(const typename NGramModel::Map &map) {
     out += it->second.count;
   }
   return out;
-}
\ No newline at end of file
+}
+
+MemoryUsage NGramModel::memory_usage() const {
+  MemoryUsage usage;
+  usage.add("alphabet", alphabet.memory_usage());
+  usage.add("maps", memory::of(maps));
+  for (const Map &map : maps) {
+    usage.add("maps.nodes", memory::of(map));
+  }
+  usage.add("nodes", memory::of(nodes));
+  usage.add("links", memory::of(links));
+  usage.add("workspace", memory::of(workspace.ps));
+  return usage;
+}
@@ -1,34 +1,51 @@
 #include "node.hpp"
 #include "util.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <limits>
 
 Node::Node(size_t level, size_t nInputs, size_t nOutputs)
-    : level(level), forwardBits(nInputs, false), backwardLogPs(nOutputs, 0.0),
-      backwardCounts(nOutputs, 0) {}
+    : nInputs(nInputs), nOutputs(nOutputs), id(0), level(level) {}
 
 Node::~Node() {}
 
+size_t Node::get_id() const { return id; }
+
+void Node::set_id(size_t id) { this->id = id; }
+
 size_t Node::get_level() const { return level; }
 
 void Node::set_level(size_t level) { this->level = level; }
 
-bool Node::get_forward_bit(size_t index) const { return forwardBits[index]; }
+bool Node::get_forward_bit(const Activation &activation, size_t index) const {
+  return activation.forwardBits[slot(activation, index)];
+}
 
-void Node::contribute_backward_loglh(size_t index, double loglh) {
-  backwardLogPs[index] += loglh;
-  backwardCounts[index]++;
+void Node::contribute_backward_loglh(Activation &activation, size_t index,
+                                     double loglh) const {
+  activation.backwardLogPs[slot(activation, index)] += loglh;
+  activation.backwardCounts[slot(activation, index)]++;
 }
 
-double Node::get_backward_logprob(size_t index) const {
-  return backwardLogPs[index] - std::log2(backwardCounts[index]);
+double Node::get_backward_logprob(const Activation &activation,
+                                  size_t index) const {
+  return activation.backwardLogPs[slot(activation, index)] -
+         std::log2(activation.backwardCounts[slot(activation, index)]);
 }
 
-void Node::clear_backward() {
-  backwardLogPs.assign(n_outputs(), 0.0);
-  backwardCounts.assign(n_outputs(), 0);
+void Node::clear_backward(Activation &activation) const {
+  const size_t begin = slot(activation, 0);
+  std::fill(activation.backwardLogPs.begin() + begin,
+            activation.backwardLogPs.begin() + begin + n_outputs(), 0.0);
+  std::fill(activation.backwardCounts.begin() + begin,
+            activation.backwardCounts.begin() + begin + n_outputs(), 0);
 }
 
-size_t Node::n_inputs() const { return forwardBits.size(); }
+size_t Node::n_inputs() const { return nInputs; }
 
-size_t Node::n_outputs() const { return backwardLogPs.size(); }
+size_t Node::n_outputs() const { return nOutputs; }
+
+size_t Node::slot(const Activation &activation, size_t index) const {
+  return activation.offsets[id] + index;
+}
@@ -0,0 +1,125 @@
+#include "online_ngram.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+#include <thread>
+
+OnlineNGramModel::Reader::Reader(const OnlineNGramModel &model)
+    : model(model), slot(MAX_READERS) {
+  for (size_t i = 0; i < MAX_READERS; i++) {
+    bool expected = false;
+    if (model.readerSlots[i].taken.compare_exchange_strong(expected, true)) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot == MAX_READERS) {
+    throw std::runtime_error("OnlineNGramModel: too many readers");
+  }
+}
+
+OnlineNGramModel::Reader::~Reader() {
+  model.readerSlots[slot].taken.store(false);
+}
+
+const std::vector<double> &
+OnlineNGramModel::Reader::probs(const State &state,
+                                Workspace &workspace) const {
+  const std::vector<double> &out = enter().probs(state, workspace);
+  leave();
+  return out;
+}
+
+double OnlineNGramModel::Reader::logprob(const State &state, char32_t c,
+                                         Workspace &workspace) const {
+  const double out = enter().logprob(state, c, workspace);
+  leave();
+  return out;
+}
+
+const NGramModel &OnlineNGramModel::Reader::enter() const {
+  // announce before looking at front, so a writer that swaps after this
+  // store is guaranteed to wait for us
+  model.readerSlots[slot].epoch.store(model.epoch.load() + 1);
+  return model.copies[model.front.load()];
+}
+
+void OnlineNGramModel::Reader::leave() const {
+  model.readerSlots[slot].epoch.store(0);
+}
+
+OnlineNGramModel::OnlineNGramModel(
+    size_t n, const Alphabet<char32_t, uint32_t> &alphabet,
+    size_t publishInterval)
+    : copies{NGramModel(n, alphabet), NGramModel(n, alphabet)}, front(0),
+      epoch(0), readerSlots(), pending(),
+      publishInterval(std::max<size_t>(publishInterval, 1)) {
+  for (ReaderSlot &slot : readerSlots) {
+    slot.taken.store(false);
+    slot.epoch.store(0);
+  }
+}
+
+typename OnlineNGramModel::State OnlineNGramModel::start() const {
+  return copies[0].start_window();
+}
+
+typename OnlineNGramModel::State OnlineNGramModel::step(State state,
+                                                        char32_t c) const {
+  return copies[0].slide(std::move(state), c);
+}
+
+typename OnlineNGramModel::Workspace OnlineNGramModel::make_workspace() const {
+  return copies[0].make_workspace();
+}
+
+const Alphabet<char32_t, uint32_t> &OnlineNGramModel::get_alphabet() const {
+  return copies[0].get_alphabet();
+}
+
+void OnlineNGramModel::observe(State state, char32_t c) {
+  copies[1 - front.load()].observe(state, c);
+  pending.emplace_back(std::move(state), c);
+  if (pending.size() >= publishInterval) {
+    publish();
+  }
+}
+
+void OnlineNGramModel::publish() {
+  if (pending.empty()) {
+    return;
+  }
+  const size_t back = 1 - front.load();
+  front.store(back);
+  const uint64_t published = epoch.fetch_add(1) + 1;
+
+  // readers that entered before the swap hold an epoch at most published;
+  // wait them out, after which nobody can be reading the old front
+  for (ReaderSlot &slot : readerSlots) {
+    uint64_t readerEpoch;
+    while ((readerEpoch = slot.epoch.load()) && readerEpoch <= published) {
+      std::this_thread::yield();
+    }
+  }
+
+  NGramModel &stale = copies[1 - back];
+  for (const auto &observation : pending) {
+    stale.observe(observation.first, observation.second);
+  }
+  pending.clear();
+}
+
+size_t OnlineNGramModel::version() const { return epoch.load(); }
+
+// Only call from the writer thread; the readers never change the copies.
+MemoryUsage OnlineNGramModel::memory_usage() const {
+  MemoryUsage usage;
+  usage.add("front", copies[front.load()].memory_usage());
+  usage.add("back", copies[1 - front.load()].memory_usage());
+  usage.add("pending", memory::of(pending));
+  for (const auto &observation : pending) {
+    usage.add("pending.states", observation.first.footprint());
+  }
+  return usage;
+}
@@ -0,0 +1,130 @@
+#include "perf_report.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <sys/resource.h>
+
+namespace {
+bool ends_with(const std::string &s, const std::string &suffix) {
+  return s.size() >= suffix.size() &&
+         s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+} // namespace
+
+void PerfReport::set(const std::string &name, double value) {
+  for (auto &metric : metrics) {
+    if (metric.first == name) {
+      metric.second = value;
+      return;
+    }
+  }
+  metrics.emplace_back(name, value);
+}
+
+bool PerfReport::get(const std::string &name, double &value) const {
+  for (const auto &metric : metrics) {
+    if (metric.first == name) {
+      value = metric.second;
+      return true;
+    }
+  }
+  return false;
+}
+
+void PerfReport::write(const std::string &path) const {
+  std::ofstream ofs(path);
+  if (!ofs.is_open()) {
+    throw std::runtime_error("cannot open " + path + " for writing");
+  }
+  ofs << std::setprecision(std::numeric_limits<double>::max_digits10) << "{";
+  for (size_t i = 0; i < metrics.size(); i++) {
+    ofs << (i ? ",\n " : "\n ") << '"' << metrics[i].first
+        << "\": " << metrics[i].second;
+  }
+  ofs << "\n}\n";
+}
+
+// Reads back what write() produces: string keys and numeric values only.
+PerfReport PerfReport::read(const std::string &path) {
+  std::ifstream ifs(path);
+  if (!ifs.is_open()) {
+    throw std::runtime_error("cannot open " + path);
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  std::string text = ss.str();
+
+  PerfReport report;
+  size_t pos = 0;
+  while ((pos = text.find('"', pos)) != std::string::npos) {
+    size_t end = text.find('"', pos + 1);
+    size_t colon = text.find(':', end);
+    if (end == std::string::npos || colon == std::string::npos) {
+      throw std::runtime_error(path + " is not a perf report");
+    }
+    std::string name = text.substr(pos + 1, end - pos - 1);
+    const char *begin = text.c_str() + colon + 1;
+    char *valueEnd;
+    double value = std::strtod(begin, &valueEnd);
+    if (valueEnd == begin) {
+      throw std::runtime_error(path + ": " + name + " is not a number");
+    }
+    report.set(name, value);
+    pos = valueEnd - text.c_str();
+  }
+  return report;
+}
+
+bool PerfReport::compare(const PerfReport &baseline, double tolerance,
+                         std::ostream &os) const {
+  bool ok = true;
+  for (const auto &metric : metrics) {
+    const std::string &name = metric.first;
+    double value = metric.second;
+    double base;
+    if (!baseline.get(name, base)) {
+      os << name << ": " << value << " (not in baseline)" << std::endl;
+      continue;
+    }
+    double change = base != 0.0 ? (value - base) / std::fabs(base)
+                    : value != 0.0 ? INFINITY
+                                   : 0.0;
+    const char *verdict = "";
+    if (ends_with(name, ".seconds") || ends_with(name, "_kb") ||
+        ends_with(name, "_bytes")) {
+      verdict = change > tolerance ? "REGRESSION" : "";
+    } else if (ends_with(name, "_per_s")) {
+      verdict = change < -tolerance ? "REGRESSION" : "";
+    } else if (std::fabs(change) > 1e-9) {
+      verdict = "CHANGED";
+    }
+    os << name << ": " << value << " vs " << base << " (" << std::showpos
+       << std::fixed << std::setprecision(1) << change * 100.0 << "%)"
+       << std::noshowpos << std::defaultfloat << std::setprecision(6);
+    if (*verdict) {
+      os << ' ' << verdict;
+      ok = false;
+    }
+    os << std::endl;
+  }
+  for (const auto &metric : baseline.metrics) {
+    double value;
+    if (!get(metric.first, value)) {
+      os << metric.first << ": (not in this run) vs " << metric.second
+         << " MISSING" << std::endl;
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+size_t peak_rss_kb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (size_t)usage.ru_maxrss;
+}
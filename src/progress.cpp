@@ -1,34 +1,160 @@
 #include "progress.hpp"
 
+#include <algorithm>
+#include <cstdio>
 #include <iomanip>
 #include <iostream>
-#include <numeric>
 #include <sstream>
+#include <stdexcept>
+#include <unistd.h>
 
-Progress::Progress(size_t total) : count(0), total(total), width(80) {
-  update();
+namespace {
+Progress::Mode defaultMode = Progress::Mode::AUTO;
+std::chrono::milliseconds barInterval(100);
+std::chrono::milliseconds logInterval(5000);
+
+// seconds as m:ss, or h:mm:ss past an hour
+std::string format_duration(double seconds) {
+  size_t s = (size_t)seconds;
+  std::stringstream ss;
+  if (s >= 3600) {
+    ss << s / 3600 << ':' << std::setw(2) << std::setfill('0')
+       << s / 60 % 60;
+  } else {
+    ss << s / 60;
+  }
+  ss << ':' << std::setw(2) << std::setfill('0') << s % 60;
+  return ss.str();
 }
 
-Progress::~Progress() {
-  // std::cerr << '\r' << std::string(width, ' ') << '\r' << std::flush;
-  std::cerr << std::endl;
+// 1234567 as 1.23M
+std::string format_rate(double rate) {
+  const char *suffixes[] = {"", "k", "M", "G"};
+  size_t i = 0;
+  while (rate >= 1000.0 && i + 1 < 4) {
+    rate /= 1000.0;
+    i++;
+  }
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(rate < 10.0 ? 2 : 1) << rate
+     << suffixes[i];
+  return ss.str();
 }
+} // namespace
 
-void Progress::set(size_t count) {
-  this->count = count;
+Progress::Progress(size_t total, const std::string &task, size_t start)
+    : count(start), chars(0), total(total), start(start), width(80),
+      task(task), mode(defaultMode), begin(Clock::now()),
+      nextDraw(0) {
+  if (mode == Mode::AUTO) {
+    mode = isatty(fileno(stderr)) ? Mode::BAR : Mode::LOG;
+  }
+  nextDraw = (begin + interval()).time_since_epoch().count();
   update();
 }
 
-void Progress::add(size_t count) {
-  this->count += count;
+Progress::~Progress() {
   update();
+  if (mode == Mode::BAR) {
+    std::cerr << std::endl;
+  }
+}
+
+void Progress::set(size_t count, size_t chars) {
+  this->count.store(count, std::memory_order_relaxed);
+  if (chars) {
+    this->chars.store(chars, std::memory_order_relaxed);
+  }
+  maybe_update();
+}
+
+void Progress::add(size_t count, size_t chars) {
+  this->count.fetch_add(count, std::memory_order_relaxed);
+  if (chars) {
+    this->chars.fetch_add(chars, std::memory_order_relaxed);
+  }
+  maybe_update();
+}
+
+void Progress::set_mode(Mode mode) { defaultMode = mode; }
+
+void Progress::set_interval(std::chrono::milliseconds interval) {
+  barInterval = interval;
+  logInterval = interval;
+}
+
+Progress::Mode Progress::parse_mode(const std::string &name) {
+  if (name == "bar") {
+    return Mode::BAR;
+  } else if (name == "log") {
+    return Mode::LOG;
+  } else if (name == "none") {
+    return Mode::NONE;
+  } else if (name == "auto") {
+    return Mode::AUTO;
+  }
+  throw std::runtime_error("progress: unknown mode " + name);
+}
+
+// Only the caller that moves nextDraw forward redraws, so concurrent adds
+// between redraws cost one clock read and one atomic load.
+void Progress::maybe_update() {
+  if (mode == Mode::NONE) {
+    return;
+  }
+  Clock::rep now = Clock::now().time_since_epoch().count();
+  Clock::rep next = nextDraw.load(std::memory_order_relaxed);
+  if (now < next) {
+    return;
+  }
+  if (nextDraw.compare_exchange_strong(next, now + interval().count())) {
+    update();
+  }
+}
+
+Progress::Clock::duration Progress::interval() const {
+  return std::chrono::duration_cast<Clock::duration>(
+      mode == Mode::BAR ? barInterval : logInterval);
 }
 
 void Progress::update() {
+  if (mode == Mode::NONE) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(drawMutex);
+  double elapsed =
+      std::chrono::duration<double>(Clock::now() - begin).count();
+  size_t done = count.load(std::memory_order_relaxed) - start;
+  double itemsPerS = elapsed > 0.0 ? done / elapsed : 0.0;
+  double charsPerS =
+      elapsed > 0.0 ? chars.load(std::memory_order_relaxed) / elapsed : 0.0;
+  size_t left = total - std::min<size_t>(count, total);
+  double eta = itemsPerS > 0.0 ? left / itemsPerS : -1.0;
+  if (mode == Mode::BAR) {
+    draw_bar(elapsed, itemsPerS, charsPerS, eta);
+  } else {
+    draw_log(elapsed, itemsPerS, charsPerS, eta);
+  }
+}
+
+void Progress::draw_bar(double elapsed, double itemsPerS, double charsPerS,
+                        double eta) {
   size_t precision = 2;
-  float progress = (float)std::min(count, total) / (float)total;
+  float progress =
+      total ? (float)std::min<size_t>(count, total) / (float)total : 1.0f;
   float percent = progress * 100.0f;
-  size_t barMaxWidth = width - 8 - precision;
+
+  std::stringstream info;
+  info << ' ' << format_duration(elapsed);
+  if (charsPerS > 0.0) {
+    info << ' ' << format_rate(charsPerS) << " chars/s";
+  } else {
+    info << ' ' << format_rate(itemsPerS) << " it/s";
+  }
+  info << " ETA " << (eta >= 0.0 ? format_duration(eta) : "?");
+  std::string infoString = info.str();
+
+  size_t barMaxWidth = width - 8 - precision - infoString.size();
   size_t barWidth = (size_t)(barMaxWidth * progress);
   std::string barString = std::string(barWidth, '#');
   float partialBarWidth = (barMaxWidth * progress - barWidth);
@@ -40,6 +166,18 @@ void Progress::update() {
   barString += std::string(barMaxWidth - barString.size(), ' ');
   std::stringstream ss;
   ss << "[" << barString << "] " << std::fixed << std::setprecision(precision)
-     << std::setw(4 + precision) << std::right << percent << '%';
+     << std::setw(4 + precision) << std::right << percent << '%'
+     << infoString;
   std::cerr << '\r' << ss.str() << std::flush;
 }
+
+void Progress::draw_log(double elapsed, double itemsPerS, double charsPerS,
+                        double eta) {
+  std::stringstream ss;
+  ss << "progress task=" << task << " items=" << count.load()
+     << " total=" << total << " chars=" << chars.load() << std::fixed
+     << std::setprecision(1) << " elapsed_s=" << elapsed << std::setprecision(2)
+     << " items_per_s=" << itemsPerS << std::setprecision(1)
+     << " chars_per_s=" << charsPerS << " eta_s=" << eta << '\n';
+  std::cerr << ss.str() << std::flush;
+}
@@ -1,7 +1,6 @@
 #include "string.hpp"
 
 #include <fcntl.h>
-#include <io.h>
 
 namespace utf {
 constexpr bool is_utf8_1byte(char8_t c) {
@@ -185,6 +184,65 @@ void write_utf8(char32_t codePoint, ostream8_t &ofs) {
   }
 }
 
+void append_utf8(char32_t codePoint, string8_t &out) {
+  if (codePoint > UTF8_4BYTE_MAX) {
+    out.push_back(INVALID);
+  } else if (codePoint > UTF8_3BYTE_MAX) {
+    char8_t bytes[4] = {
+        encode_chunk<char8_t>(codePoint, 3 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_4BYTE_DATA_MASK, UTF8_4BYTE_SIGNAL),
+        encode_chunk<char8_t>(codePoint, 2 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_XBYTE_DATA_MASK, UTF8_XBYTE_SIGNAL),
+        encode_chunk<char8_t>(codePoint, 1 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_XBYTE_DATA_MASK, UTF8_XBYTE_SIGNAL),
+        encode_chunk<char8_t>(codePoint, 0 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_XBYTE_DATA_MASK, UTF8_XBYTE_SIGNAL)};
+    out.append(bytes, 4);
+  } else if (codePoint > UTF8_2BYTE_MAX) {
+    char8_t bytes[3] = {
+        encode_chunk<char8_t>(codePoint, 2 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_3BYTE_DATA_MASK, UTF8_3BYTE_SIGNAL),
+        encode_chunk<char8_t>(codePoint, 1 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_XBYTE_DATA_MASK, UTF8_XBYTE_SIGNAL),
+        encode_chunk<char8_t>(codePoint, 0 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_XBYTE_DATA_MASK, UTF8_XBYTE_SIGNAL)};
+    out.append(bytes, 3);
+  } else if (codePoint > UTF8_1BYTE_MAX) {
+    char8_t bytes[2] = {
+        encode_chunk<char8_t>(codePoint, 1 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_2BYTE_DATA_MASK, UTF8_2BYTE_SIGNAL),
+        encode_chunk<char8_t>(codePoint, 0 * UTF8_XBYTE_DATA_LENGTH,
+                              UTF8_XBYTE_DATA_MASK, UTF8_XBYTE_SIGNAL)};
+    out.append(bytes, 2);
+  } else {
+    out.push_back(char8_t(codePoint));
+  }
+}
+
+Utf8Writer::Utf8Writer(ostream8_t &ofs) : ofs(ofs) {
+  buffer.reserve(BUFFER_SIZE + 4);
+}
+
+Utf8Writer::~Utf8Writer() { flush(); }
+
+void Utf8Writer::write(char32_t codePoint) {
+  append_utf8(codePoint, buffer);
+  if (buffer.size() >= BUFFER_SIZE) {
+    flush();
+  }
+}
+
+void Utf8Writer::write(const string32_t &s) {
+  for (char32_t c : s) {
+    write(c);
+  }
+}
+
+void Utf8Writer::flush() {
+  ofs.write(buffer.data(), buffer.size());
+  buffer.clear();
+}
+
 void write_utf16(char32_t codePoint, ostream16_t &ofs) {
   if (codePoint > UTF16_2WORD_MAX) {
     ofs.put(INVALID);
@@ -0,0 +1,241 @@
+#include "suffix_array_model.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+SuffixArrayModel::SuffixArrayModel(
+    const corpus_t &corpus, const Alphabet<char32_t, uint32_t> &alphabet,
+    size_t minCount, double smoothing)
+    : alphabet(alphabet), minCount(std::max<size_t>(minCount, 1)),
+      smoothing(smoothing) {
+  if (alphabet.size() > 256) {
+    throw std::runtime_error("suffix array: more than 256 symbols");
+  }
+  size_t n = 0;
+  for (const string32_t &s : corpus) {
+    n += s.size() + 2;
+  }
+  if (n >= std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("suffix array: corpus too large");
+  }
+  text.reserve(n);
+  for (const string32_t &s : corpus) {
+    text.push_back(alphabet.serialize(utf::BEG_STRING));
+    for (char32_t c : s) {
+      text.push_back(alphabet.serialize(c));
+    }
+    text.push_back(alphabet.serialize(utf::END_STRING));
+  }
+  build();
+}
+
+// Prefix doubling: after the round for k, suffixes are sorted by their first
+// 2k symbols and rank holds each suffix's class in that order. Each round is
+// two counting sorts, so construction is O(N log N) with 12 bytes per symbol
+// of scratch space.
+void SuffixArrayModel::build() {
+  const uint32_t n = (uint32_t)text.size();
+  suffixes.resize(n);
+  if (!n) {
+    return;
+  }
+  std::vector<uint32_t> rank(text.begin(), text.end());
+  std::vector<uint32_t> tmp(n);
+  std::vector<uint32_t> count(std::max<uint32_t>(n, 256) + 1);
+  for (uint32_t i = 0; i < n; i++) {
+    count[rank[i] + 1]++;
+  }
+  for (size_t r = 1; r < count.size(); r++) {
+    count[r] += count[r - 1];
+  }
+  for (uint32_t i = 0; i < n; i++) {
+    suffixes[count[rank[i]]++] = i;
+  }
+  // classes by first symbol
+  tmp[suffixes[0]] = 0;
+  for (uint32_t i = 1; i < n; i++) {
+    tmp[suffixes[i]] = tmp[suffixes[i - 1]] +
+                       (text[suffixes[i]] != text[suffixes[i - 1]]);
+  }
+  rank.swap(tmp);
+
+  for (uint32_t k = 1; rank[suffixes[n - 1]] + 1 < n; k *= 2) {
+    // by second half: suffixes without one come first
+    uint32_t p = 0;
+    for (uint32_t i = n - std::min(k, n); i < n; i++) {
+      tmp[p++] = i;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      if (suffixes[i] >= k) {
+        tmp[p++] = suffixes[i] - k;
+      }
+    }
+    // stably by first half
+    std::fill(count.begin(), count.end(), 0);
+    for (uint32_t i = 0; i < n; i++) {
+      count[rank[i] + 1]++;
+    }
+    for (size_t r = 1; r < count.size(); r++) {
+      count[r] += count[r - 1];
+    }
+    for (uint32_t i = 0; i < n; i++) {
+      suffixes[count[rank[tmp[i]]]++] = tmp[i];
+    }
+
+    auto second = [&](uint32_t i) {
+      return i + k < n ? (int64_t)rank[i + k] : -1;
+    };
+    tmp[suffixes[0]] = 0;
+    for (uint32_t i = 1; i < n; i++) {
+      uint32_t a = suffixes[i - 1];
+      uint32_t b = suffixes[i];
+      tmp[b] = tmp[a] + (rank[a] != rank[b] || second(a) != second(b));
+    }
+    rank.swap(tmp);
+  }
+}
+
+typename SuffixArrayModel::State SuffixArrayModel::root() const {
+  return State{0, (uint32_t)suffixes.size(), 0};
+}
+
+typename SuffixArrayModel::State SuffixArrayModel::start() const {
+  return step(root(), utf::BEG_STRING);
+}
+
+uint32_t SuffixArrayModel::first_continued(const State &state) const {
+  // a suffix that is exactly the context sorts first
+  uint32_t lo = state[LO];
+  if (lo < state[HI] && suffixes[lo] + state[DEPTH] == text.size()) {
+    lo++;
+  }
+  return lo;
+}
+
+typename SuffixArrayModel::State
+SuffixArrayModel::refine(const State &state, uint32_t sc) const {
+  const uint32_t depth = state[DEPTH];
+  auto begin = suffixes.begin() + first_continued(state);
+  auto end = suffixes.begin() + state[HI];
+  auto lo = std::lower_bound(begin, end, sc, [&](uint32_t pos, uint32_t sc) {
+    return text[pos + depth] < sc;
+  });
+  auto hi = std::upper_bound(lo, end, sc, [&](uint32_t sc, uint32_t pos) {
+    return sc < text[pos + depth];
+  });
+  return State{(uint32_t)(lo - suffixes.begin()),
+               (uint32_t)(hi - suffixes.begin()), depth + 1};
+}
+
+typename SuffixArrayModel::State
+SuffixArrayModel::find(uint32_t pos, uint32_t length, uint32_t sc) const {
+  // negative if the suffix sorts before the pattern, zero if it starts with it
+  auto compare = [&](uint32_t suffix) {
+    const uint32_t n = std::min<uint32_t>(length, text.size() - suffix);
+    int order = std::memcmp(text.data() + suffix, text.data() + pos, n);
+    if (order || n < length || suffix + length == text.size()) {
+      // a suffix that ends inside the pattern sorts first
+      return order ? order : -1;
+    }
+    return (int)text[suffix + length] - (int)sc;
+  };
+  auto lo = std::partition_point(suffixes.begin(), suffixes.end(),
+                                 [&](uint32_t suffix) {
+                                   return compare(suffix) < 0;
+                                 });
+  auto hi = std::partition_point(lo, suffixes.end(), [&](uint32_t suffix) {
+    return compare(suffix) == 0;
+  });
+  return State{(uint32_t)(lo - suffixes.begin()),
+               (uint32_t)(hi - suffixes.begin()), length + 1};
+}
+
+typename SuffixArrayModel::State SuffixArrayModel::step(const State &state,
+                                                        char32_t c) const {
+  const uint32_t sc = alphabet.serialize(c);
+  State next = refine(state, sc);
+  if (next[HI] - next[LO] >= minCount) {
+    return next;
+  }
+  // Drop symbols from the front of the context until it occurs often enough.
+  // Every suffix of a context that does occurs too, so binary search on the
+  // number of symbols kept; the kept ones are read from any occurrence.
+  State best = refine(root(), sc);
+  if (best[HI] - best[LO] < minCount) {
+    return root();
+  }
+  const uint32_t end = state[DEPTH] ? suffixes[state[LO]] + state[DEPTH] : 0;
+  uint32_t found = 0;
+  uint32_t failed = state[DEPTH];
+  while (failed - found > 1) {
+    uint32_t kept = found + (failed - found) / 2;
+    State candidate = find(end - kept, kept, sc);
+    if (candidate[HI] - candidate[LO] >= minCount) {
+      found = kept;
+      best = candidate;
+    } else {
+      failed = kept;
+    }
+  }
+  return best;
+}
+
+typename SuffixArrayModel::Workspace SuffixArrayModel::make_workspace() const {
+  return Workspace{std::vector<double>(alphabet.size())};
+}
+
+const std::vector<double> &SuffixArrayModel::probs(const State &state,
+                                                   Workspace &workspace) const {
+  const uint32_t depth = state[DEPTH];
+  const uint32_t lo = first_continued(state);
+  const double denominator =
+      (double)(state[HI] - lo) + smoothing * alphabet.size();
+  std::vector<double> &probs = workspace.ps;
+  probs.assign(alphabet.size(), smoothing / denominator);
+  // continuations are sorted, so count them one run at a time
+  auto it = suffixes.begin() + lo;
+  auto end = suffixes.begin() + state[HI];
+  while (it != end) {
+    uint32_t sc = text[*it + depth];
+    auto runEnd =
+        std::upper_bound(it, end, sc, [&](uint32_t sc, uint32_t pos) {
+          return sc < text[pos + depth];
+        });
+    probs[sc] = ((double)(runEnd - it) + smoothing) / denominator;
+    it = runEnd;
+  }
+  return probs;
+}
+
+double SuffixArrayModel::logprob(const State &state, char32_t c,
+                                 Workspace &) const {
+  State next = refine(state, alphabet.serialize(c));
+  const double total = state[HI] - first_continued(state);
+  return std::log2(((double)(next[HI] - next[LO]) + smoothing) /
+                   (total + smoothing * alphabet.size()));
+}
+
+const Alphabet<char32_t, uint32_t> &SuffixArrayModel::get_alphabet() const {
+  return alphabet;
+}
+
+size_t SuffixArrayModel::get_min_count() const { return minCount; }
+
+double SuffixArrayModel::get_smoothing() const { return smoothing; }
+
+size_t SuffixArrayModel::context_size() const { return State().size(); }
+
+size_t SuffixArrayModel::revision() const { return 0; }
+
+size_t SuffixArrayModel::size() const { return text.size(); }
+
+MemoryUsage SuffixArrayModel::memory_usage() const {
+  MemoryUsage usage;
+  usage.add("alphabet", alphabet.memory_usage());
+  usage.add("text", memory::of(text));
+  usage.add("suffixes", memory::of(suffixes));
+  return usage;
+}
@@ -0,0 +1,273 @@
+#include "tensor_bundle.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+namespace {
+const uint64_t TABLE_MAGIC = 0xdb4775248b80fb57ull;
+const size_t FOOTER_SIZE = 48;
+// compression type byte and crc that follow every block
+const size_t BLOCK_TRAILER_SIZE = 5;
+
+std::runtime_error error(const std::string &what) {
+  return std::runtime_error("tensor bundle: " + what);
+}
+
+std::string read_file(const std::string &path) {
+  std::ifstream ifs(path, std::ios::binary);
+  if (!ifs.is_open()) {
+    throw error("cannot open " + path);
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  return ss.str();
+}
+
+// Cursor over a byte range holding varints and protobuf fields.
+struct Reader {
+  const char *pos;
+  const char *end;
+
+  bool done() const { return pos >= end; }
+
+  uint64_t varint() {
+    uint64_t out = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      if (pos >= end) {
+        throw error("truncated varint");
+      }
+      uint8_t byte = (uint8_t)*pos++;
+      out |= (uint64_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80)) {
+        return out;
+      }
+    }
+    throw error("overlong varint");
+  }
+
+  uint32_t fixed32() {
+    if (end - pos < 4) {
+      throw error("truncated fixed32");
+    }
+    uint32_t out;
+    std::memcpy(&out, pos, 4);
+    pos += 4;
+    return out;
+  }
+
+  Reader bytes(size_t n) {
+    if ((size_t)(end - pos) < n) {
+      throw error("truncated field");
+    }
+    Reader out{pos, pos + n};
+    pos += n;
+    return out;
+  }
+
+  // skips a protobuf field of the given wire type
+  void skip(uint32_t wireType) {
+    switch (wireType) {
+    case 0:
+      varint();
+      break;
+    case 1:
+      bytes(8);
+      break;
+    case 2:
+      bytes(varint());
+      break;
+    case 5:
+      bytes(4);
+      break;
+    default:
+      throw error("unsupported wire type");
+    }
+  }
+};
+
+// Calls f(key, value) for every entry of the LevelDB block at handle.
+template <class F>
+void for_each_in_block(const std::string &file, Reader handle, F &&f) {
+  uint64_t offset = handle.varint();
+  uint64_t size = handle.varint();
+  if (offset + size + BLOCK_TRAILER_SIZE > file.size() || size < 4) {
+    throw error("block out of range");
+  }
+  if (file[offset + size] != 0) {
+    throw error("compressed blocks are not supported");
+  }
+  const char *block = file.data() + offset;
+  uint32_t nRestarts;
+  std::memcpy(&nRestarts, block + size - 4, 4);
+  if (4 + 4 * (uint64_t)nRestarts > size) {
+    throw error("corrupt block");
+  }
+  Reader entries{block, block + size - 4 - 4 * nRestarts};
+  std::string key;
+  while (!entries.done()) {
+    uint64_t shared = entries.varint();
+    uint64_t nonShared = entries.varint();
+    uint64_t valueSize = entries.varint();
+    if (shared > key.size()) {
+      throw error("corrupt block");
+    }
+    Reader suffix = entries.bytes(nonShared);
+    key.resize(shared);
+    key.append(suffix.pos, nonShared);
+    f(key, entries.bytes(valueSize));
+  }
+}
+
+std::vector<size_t> parse_shape(Reader shape) {
+  std::vector<size_t> out;
+  while (!shape.done()) {
+    uint64_t tag = shape.varint();
+    if (tag >> 3 == 2 && (tag & 7) == 2) {
+      Reader dim = shape.bytes(shape.varint());
+      size_t size = 0;
+      while (!dim.done()) {
+        uint64_t dimTag = dim.varint();
+        if (dimTag >> 3 == 1 && (dimTag & 7) == 0) {
+          size = dim.varint();
+        } else {
+          dim.skip(dimTag & 7);
+        }
+      }
+      out.push_back(size);
+    } else {
+      shape.skip(tag & 7);
+    }
+  }
+  return out;
+}
+
+TensorBundle::Entry parse_entry(Reader proto) {
+  TensorBundle::Entry entry{0, {}, 0, 0, 0};
+  while (!proto.done()) {
+    uint64_t tag = proto.varint();
+    switch (tag) {
+    case 1 << 3 | 0:
+      entry.dtype = (uint32_t)proto.varint();
+      break;
+    case 2 << 3 | 2:
+      entry.shape = parse_shape(proto.bytes(proto.varint()));
+      break;
+    case 3 << 3 | 0:
+      entry.shard = (uint32_t)proto.varint();
+      break;
+    case 4 << 3 | 0:
+      entry.offset = proto.varint();
+      break;
+    case 5 << 3 | 0:
+      entry.size = proto.varint();
+      break;
+    default:
+      proto.skip(tag & 7);
+    }
+  }
+  return entry;
+}
+} // namespace
+
+TensorBundle::TensorBundle(const std::string &prefix)
+    : prefix(prefix), nShards(1) {
+  const std::string index = read_file(prefix + ".index");
+  if (index.size() < FOOTER_SIZE) {
+    throw error(prefix + ".index is not a tensor bundle index");
+  }
+  uint64_t magic;
+  std::memcpy(&magic, index.data() + index.size() - 8, 8);
+  if (magic != TABLE_MAGIC) {
+    throw error(prefix + ".index is not a tensor bundle index");
+  }
+  Reader footer{index.data() + index.size() - FOOTER_SIZE,
+                index.data() + index.size() - 8};
+  // the metaindex block is empty in bundles
+  footer.varint();
+  footer.varint();
+  Reader indexHandle = footer;
+
+  for_each_in_block(index, indexHandle, [&](const std::string &, Reader handle) {
+    for_each_in_block(index, handle, [&](const std::string &key, Reader value) {
+      if (key.empty()) {
+        // BundleHeaderProto
+        while (!value.done()) {
+          uint64_t tag = value.varint();
+          if (tag == (1 << 3 | 0)) {
+            nShards = (uint32_t)value.varint();
+          } else if (tag == (2 << 3 | 0)) {
+            if (value.varint() != 0) {
+              throw error("big-endian bundles are not supported");
+            }
+          } else {
+            value.skip(tag & 7);
+          }
+        }
+      } else {
+        entries.insert_or_assign(key, parse_entry(value));
+      }
+    });
+  });
+}
+
+bool TensorBundle::has(const std::string &name) const {
+  return entries.count(name);
+}
+
+const TensorBundle::Entry &TensorBundle::entry(const std::string &name) const {
+  auto it = entries.find(name);
+  if (it == entries.end()) {
+    throw error(prefix + " has no tensor " + name);
+  }
+  return it->second;
+}
+
+std::vector<std::string> TensorBundle::names() const {
+  std::vector<std::string> out;
+  for (const auto &entry : entries) {
+    out.push_back(entry.first);
+  }
+  return out;
+}
+
+std::vector<float> TensorBundle::read_floats(
+    const std::string &name, const std::vector<size_t> &shape) const {
+  const Entry &e = entry(name);
+  if (e.dtype != DT_FLOAT) {
+    throw error(name + " is not a float tensor");
+  }
+  if (e.shape != shape) {
+    std::stringstream ss;
+    ss << name << " has shape [";
+    for (size_t i = 0; i < e.shape.size(); i++) {
+      ss << (i ? ", " : "") << e.shape[i];
+    }
+    ss << "]";
+    throw error(ss.str());
+  }
+  size_t n = 1;
+  for (size_t dim : shape) {
+    n *= dim;
+  }
+  if (e.size != n * sizeof(float)) {
+    throw error(name + " has the wrong byte size");
+  }
+
+  char shardName[32];
+  std::snprintf(shardName, sizeof(shardName), ".data-%05u-of-%05u", e.shard,
+                nShards);
+  std::ifstream ifs(prefix + shardName, std::ios::binary);
+  if (!ifs.is_open()) {
+    throw error("cannot open " + prefix + shardName);
+  }
+  std::vector<float> out(n);
+  ifs.seekg((std::streamoff)e.offset);
+  ifs.read((char *)out.data(), (std::streamsize)e.size);
+  if (!ifs) {
+    throw error(prefix + shardName + " ends inside " + name);
+  }
+  return out;
+}
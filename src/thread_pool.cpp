@@ -0,0 +1,57 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t nThreads)
+    : threads(), task(nullptr), nTasks(0), nextTask(0), nDone(0),
+      generation(0), stopping(false) {
+  for (size_t i = 0; i < std::max<size_t>(nThreads, 1); i++) {
+    threads.emplace_back(&ThreadPool::work, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  startCv.notify_all();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+}
+
+size_t ThreadPool::size() const { return threads.size(); }
+
+void ThreadPool::run(size_t nTasks, const std::function<void(size_t)> &task) {
+  std::unique_lock<std::mutex> lock(mutex);
+  this->task = &task;
+  this->nTasks = nTasks;
+  nextTask = 0;
+  nDone = 0;
+  generation++;
+  startCv.notify_all();
+  doneCv.wait(lock, [this]() { return nDone == this->nTasks; });
+  this->task = nullptr;
+}
+
+void ThreadPool::work() {
+  size_t seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    startCv.wait(lock, [&]() { return stopping || generation != seen; });
+    if (stopping) {
+      return;
+    }
+    seen = generation;
+    while (nextTask < nTasks) {
+      size_t i = nextTask++;
+      lock.unlock();
+      (*task)(i);
+      lock.lock();
+      if (++nDone == nTasks) {
+        doneCv.notify_all();
+      }
+    }
+  }
+}
@@ -0,0 +1,94 @@
+#include "trace.hpp"
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace trace {
+std::atomic<int> activeLevel((int)Level::OFF);
+
+namespace {
+struct Event {
+  const char *name;
+  uint64_t beginNs;
+  uint64_t endNs;
+};
+
+struct Buffer {
+  size_t tid;
+  std::vector<Event> events;
+};
+
+// Buffers are shared with the registry so they outlive their threads.
+std::mutex registryMutex;
+std::vector<std::shared_ptr<Buffer>> buffers;
+std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+Buffer &local_buffer() {
+  thread_local std::shared_ptr<Buffer> buffer = []() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    buffers.push_back(std::make_shared<Buffer>(Buffer{buffers.size(), {}}));
+    return buffers.back();
+  }();
+  return *buffer;
+}
+
+void write_escaped(std::ofstream &ofs, const char *s) {
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') {
+      ofs << '\\';
+    }
+    ofs << *s;
+  }
+}
+} // namespace
+
+void start(Level level) {
+  origin = std::chrono::steady_clock::now();
+  activeLevel.store((int)level);
+}
+
+void stop() { activeLevel.store((int)Level::OFF); }
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - origin)
+      .count();
+}
+
+void record(const char *name, uint64_t beginNs, uint64_t endNs) {
+  local_buffer().events.push_back(Event{name, beginNs, endNs});
+}
+
+size_t write(const std::string &path) {
+  stop();
+  std::ofstream ofs(path);
+  if (!ofs.is_open()) {
+    throw std::runtime_error("cannot open " + path + " for writing");
+  }
+  std::lock_guard<std::mutex> lock(registryMutex);
+  size_t nEvents = 0;
+  ofs << std::fixed << std::setprecision(3);
+  ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  for (const std::shared_ptr<Buffer> &buffer : buffers) {
+    ofs << (nEvents++ ? ",\n" : "\n")
+        << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": "
+        << buffer->tid << ", \"args\": {\"name\": \""
+        << "thread " << buffer->tid << "\"}}";
+    for (const Event &event : buffer->events) {
+      ofs << ",\n{\"name\": \"";
+      write_escaped(ofs, event.name);
+      ofs << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid
+          << ", \"ts\": " << event.beginNs / 1000.0
+          << ", \"dur\": " << (event.endNs - event.beginNs) / 1000.0 << "}";
+    }
+    nEvents += buffer->events.size();
+  }
+  ofs << "\n]}\n";
+  return nEvents - buffers.size();
+}
+} // namespace trace
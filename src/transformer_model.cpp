@@ -0,0 +1,487 @@
+#include "transformer_model.hpp"
+
+#include "tensor_bundle.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+
+namespace {
+const float LAYER_NORM_EPSILON = 1e-3f;
+
+std::runtime_error error(const std::string &what) {
+  return std::runtime_error("transformer: " + what);
+}
+
+struct Metadata {
+  std::vector<string32_t> alphabet;
+  size_t receptiveField;
+  size_t dims;
+};
+
+// Just enough JSON for the metadata file: an object whose values are
+// numbers or arrays of strings.
+class MetadataParser {
+public:
+  explicit MetadataParser(const string32_t &text) : text(text), pos(0) {}
+
+  Metadata parse() {
+    Metadata out{{}, 0, 0};
+    expect(U'{');
+    while (true) {
+      string32_t name = string();
+      expect(U':');
+      skip_space();
+      if (pos < text.size() && text[pos] == U'[') {
+        pos++;
+        std::vector<string32_t> items;
+        while (!consume(U']')) {
+          items.push_back(string());
+          consume(U',');
+        }
+        if (name == U"alphabet") {
+          out.alphabet = items;
+        }
+      } else {
+        size_t value = number();
+        if (name == U"receptive_field") {
+          out.receptiveField = value;
+        } else if (name == U"dims") {
+          out.dims = value;
+        }
+      }
+      if (!consume(U',')) {
+        break;
+      }
+    }
+    expect(U'}');
+    return out;
+  }
+
+private:
+  void skip_space() {
+    while (pos < text.size() && (text[pos] == U' ' || text[pos] == U'\n' ||
+                                 text[pos] == U'\t' || text[pos] == U'\r')) {
+      pos++;
+    }
+  }
+
+  bool consume(char32_t c) {
+    skip_space();
+    if (pos < text.size() && text[pos] == c) {
+      pos++;
+      return true;
+    }
+    return false;
+  }
+
+  void expect(char32_t c) {
+    if (!consume(c)) {
+      throw error("malformed metadata");
+    }
+  }
+
+  uint32_t hex4() {
+    if (pos + 4 > text.size()) {
+      throw error("malformed metadata");
+    }
+    uint32_t out = 0;
+    for (size_t i = 0; i < 4; i++) {
+      char32_t c = text[pos++];
+      out <<= 4;
+      if (c >= U'0' && c <= U'9') {
+        out |= c - U'0';
+      } else if (c >= U'a' && c <= U'f') {
+        out |= c - U'a' + 10;
+      } else if (c >= U'A' && c <= U'F') {
+        out |= c - U'A' + 10;
+      } else {
+        throw error("malformed metadata");
+      }
+    }
+    return out;
+  }
+
+  string32_t string() {
+    expect(U'"');
+    string32_t out;
+    while (pos < text.size() && text[pos] != U'"') {
+      char32_t c = text[pos++];
+      if (c != U'\\') {
+        out.push_back(c);
+        continue;
+      }
+      if (pos >= text.size()) {
+        break;
+      }
+      switch (c = text[pos++]) {
+      case U'n':
+        out.push_back(U'\n');
+        break;
+      case U't':
+        out.push_back(U'\t');
+        break;
+      case U'r':
+        out.push_back(U'\r');
+        break;
+      case U'b':
+        out.push_back(U'\b');
+        break;
+      case U'f':
+        out.push_back(U'\f');
+        break;
+      case U'u': {
+        uint32_t unit = hex4();
+        if (unit >= 0xd800 && unit < 0xdc00 && pos + 6 <= text.size() &&
+            text[pos] == U'\\' && text[pos + 1] == U'u') {
+          pos += 2;
+          uint32_t low = hex4();
+          unit = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+        }
+        out.push_back((char32_t)unit);
+        break;
+      }
+      default:
+        out.push_back(c);
+      }
+    }
+    expect(U'"');
+    return out;
+  }
+
+  size_t number() {
+    skip_space();
+    size_t begin = pos;
+    size_t out = 0;
+    while (pos < text.size() && text[pos] >= U'0' && text[pos] <= U'9') {
+      out = out * 10 + (text[pos++] - U'0');
+    }
+    if (pos == begin) {
+      throw error("malformed metadata");
+    }
+    return out;
+  }
+
+private:
+  const string32_t &text;
+  size_t pos;
+};
+
+Metadata read_metadata(const std::string &path) {
+  std::ifstream ifs(path);
+  if (!ifs.is_open()) {
+    throw error("cannot open " + path);
+  }
+  string32_t text;
+  char32_t codePoint;
+  while ((codePoint = utf::read_utf8(ifs)) != utf::END_STREAM) {
+    text.push_back(codePoint);
+  }
+  return MetadataParser(text).parse();
+}
+
+// The symbol a metadata alphabet entry stands for.
+char32_t symbol_of(const string32_t &token) {
+  if (token == U"<BOS>") {
+    return utf::BEG_STRING;
+  } else if (token == U"<EOS>") {
+    return utf::END_STRING;
+  } else if (token == U"<UNK>") {
+    return utf::UNKNOWN;
+  } else if (token.size() == 1) {
+    return token[0];
+  }
+  throw error("unexpected alphabet entry");
+}
+
+std::string variable(const std::string &object) {
+  return object + "/.ATTRIBUTES/VARIABLE_VALUE";
+}
+
+// Kernels of the AttentionPlus blocks are only reachable through
+// trainable_variables, numbered from 1 after the embedding, 12 per block.
+std::string block_variable(size_t block, size_t index) {
+  return variable("trainable_variables/" +
+                  std::to_string(1 + 12 * block + index));
+}
+
+void add_bias(float *rows, const std::vector<float> &bias, size_t nRows) {
+  for (size_t i = 0; i < nRows; i++) {
+    for (size_t j = 0; j < bias.size(); j++) {
+      rows[i * bias.size() + j] += bias[j];
+    }
+  }
+}
+
+void softmax_rows(float *rows, size_t nRows, size_t n) {
+  for (size_t i = 0; i < nRows; i++) {
+    float *row = rows + i * n;
+    float winner = *std::max_element(row, row + n);
+    float total = 0.0f;
+    for (size_t j = 0; j < n; j++) {
+      total += row[j] = std::exp(row[j] - winner);
+    }
+    for (size_t j = 0; j < n; j++) {
+      row[j] /= total;
+    }
+  }
+}
+} // namespace
+
+TransformerModel::TransformerModel(const std::string &path)
+    : alphabet(std::vector<char32_t>{utf::BEG_STRING, utf::END_STRING,
+                                     utf::UNKNOWN}) {
+  Metadata metadata = read_metadata(path + ".metadata.json");
+  window = metadata.receptiveField;
+  dims = metadata.dims;
+  nTokens = metadata.alphabet.size();
+  if (!window || !dims || !nTokens) {
+    throw error(path + ".metadata.json is incomplete");
+  }
+
+  std::vector<char32_t> serialOrder = {utf::BEG_STRING, utf::END_STRING,
+                                       utf::UNKNOWN};
+  std::vector<uint32_t> specialTokens(3, UINT32_MAX);
+  std::vector<uint32_t> otherTokens;
+  for (uint32_t token = 0; token < nTokens; token++) {
+    char32_t c = symbol_of(metadata.alphabet[token]);
+    auto special = std::find(serialOrder.begin(), serialOrder.begin() + 3, c);
+    if (special != serialOrder.begin() + 3) {
+      specialTokens[special - serialOrder.begin()] = token;
+    } else {
+      serialOrder.push_back(c);
+      otherTokens.push_back(token);
+    }
+  }
+  if (std::count(specialTokens.begin(), specialTokens.end(), UINT32_MAX)) {
+    throw error("alphabet lacks <BOS>, <EOS> or <UNK>");
+  }
+  alphabet = Alphabet<>(serialOrder);
+  tokenOf = specialTokens;
+  tokenOf.insert(tokenOf.end(), otherTokens.begin(), otherTokens.end());
+
+  TensorBundle bundle(path + "/variables/variables");
+  const TensorBundle::Entry &query = bundle.entry(block_variable(0, 0));
+  if (query.shape.size() != 3 || query.shape[0] != dims) {
+    throw error("unexpected attention kernel shape");
+  }
+  nHeads = query.shape[1];
+  keyDims = query.shape[2];
+  const size_t width = nHeads * keyDims;
+  size_t nBlocks = 0;
+  while (bundle.has(block_variable(nBlocks, 0))) {
+    nBlocks++;
+  }
+
+  embeddings = bundle.read_floats(
+      variable("layer_with_weights-0/embeddings"), {nTokens, dims});
+  for (size_t b = 0; b < nBlocks; b++) {
+    Block block;
+    block.qkvKernel.resize(dims * 3 * width);
+    block.qkvBias.resize(3 * width);
+    for (size_t part = 0; part < 3; part++) {
+      std::vector<float> kernel = bundle.read_floats(
+          block_variable(b, 2 * part), {dims, nHeads, keyDims});
+      std::vector<float> bias =
+          bundle.read_floats(block_variable(b, 2 * part + 1), {nHeads, keyDims});
+      for (size_t i = 0; i < dims; i++) {
+        std::copy(kernel.begin() + i * width, kernel.begin() + (i + 1) * width,
+                  block.qkvKernel.begin() + i * 3 * width + part * width);
+      }
+      std::copy(bias.begin(), bias.end(),
+                block.qkvBias.begin() + part * width);
+    }
+    block.outputKernel =
+        bundle.read_floats(block_variable(b, 6), {nHeads, keyDims, dims});
+    block.outputBias = bundle.read_floats(block_variable(b, 7), {dims});
+    block.gamma = bundle.read_floats(block_variable(b, 8), {dims});
+    block.beta = bundle.read_floats(block_variable(b, 9), {dims});
+    block.denseKernel = bundle.read_floats(block_variable(b, 10), {dims, dims});
+    block.denseBias = bundle.read_floats(block_variable(b, 11), {dims});
+    blocks.push_back(std::move(block));
+  }
+  if (blocks.empty()) {
+    throw error(path + " has no attention blocks");
+  }
+
+  const std::string conv =
+      "layer_with_weights-" + std::to_string(nBlocks + 1);
+  const std::string dense =
+      "layer_with_weights-" + std::to_string(nBlocks + 2);
+  convKernel = bundle.read_floats(variable(conv + "/kernel"),
+                                  {window, dims, nTokens});
+  convBias = bundle.read_floats(variable(conv + "/bias"), {nTokens});
+  outKernel =
+      bundle.read_floats(variable(dense + "/kernel"), {nTokens, nTokens});
+  outBias = bundle.read_floats(variable(dense + "/bias"), {nTokens});
+
+  embeddingQkv.resize(nTokens * 3 * width);
+  matmul(embeddings.data(), blocks[0].qkvKernel.data(), embeddingQkv.data(),
+         nTokens, dims, 3 * width);
+  add_bias(embeddingQkv.data(), blocks[0].qkvBias, nTokens);
+}
+
+typename TransformerModel::State TransformerModel::start() const {
+  return State(window, alphabet.serialize(utf::BEG_STRING));
+}
+
+typename TransformerModel::State TransformerModel::step(State state,
+                                                        char32_t c) const {
+  state.push_back(alphabet.serialize(c));
+  state.erase(state.begin());
+  return state;
+}
+
+typename TransformerModel::Workspace TransformerModel::make_workspace() const {
+  const size_t width = nHeads * keyDims;
+  Workspace workspace;
+  workspace.tokens.resize(window);
+  workspace.x.resize(window * dims);
+  workspace.qkv.resize(window * 3 * width);
+  workspace.query.resize(window * keyDims);
+  workspace.key.resize(window * keyDims);
+  workspace.value.resize(window * keyDims);
+  workspace.scores.resize(window * window);
+  workspace.context.resize(window * keyDims);
+  workspace.heads.resize(window * width);
+  workspace.y.resize(window * dims);
+  workspace.logits.resize(nTokens);
+  workspace.outLogits.resize(nTokens);
+  workspace.ps.resize(alphabet.size());
+  return workspace;
+}
+
+// Normalizes every row of x in place, then scales and shifts it.
+void TransformerModel::layer_norm(float *x, const Block &block) const {
+  for (size_t t = 0; t < window; t++) {
+    float *row = x + t * dims;
+    float mean = 0.0f;
+    for (size_t i = 0; i < dims; i++) {
+      mean += row[i];
+    }
+    mean /= dims;
+    float variance = 0.0f;
+    for (size_t i = 0; i < dims; i++) {
+      variance += (row[i] - mean) * (row[i] - mean);
+    }
+    variance /= dims;
+    const float scale = 1.0f / std::sqrt(variance + LAYER_NORM_EPSILON);
+    for (size_t i = 0; i < dims; i++) {
+      row[i] = (row[i] - mean) * scale * block.gamma[i] + block.beta[i];
+    }
+  }
+}
+
+const std::vector<double> &
+TransformerModel::probs(const State &state, Workspace &workspace) const {
+  const size_t width = nHeads * keyDims;
+  const float queryScale = 1.0f / std::sqrt((float)keyDims);
+  Workspace &ws = workspace;
+  for (size_t t = 0; t < window; t++) {
+    ws.tokens[t] = tokenOf[state[state.size() - window + t]];
+    std::copy(embeddings.begin() + ws.tokens[t] * dims,
+              embeddings.begin() + (ws.tokens[t] + 1) * dims,
+              ws.x.begin() + t * dims);
+  }
+
+  for (size_t b = 0; b < blocks.size(); b++) {
+    const Block &block = blocks[b];
+    if (b == 0) {
+      for (size_t t = 0; t < window; t++) {
+        std::copy(embeddingQkv.begin() + ws.tokens[t] * 3 * width,
+                  embeddingQkv.begin() + (ws.tokens[t] + 1) * 3 * width,
+                  ws.qkv.begin() + t * 3 * width);
+      }
+    } else {
+      matmul(ws.x.data(), block.qkvKernel.data(), ws.qkv.data(), window, dims,
+             3 * width);
+      add_bias(ws.qkv.data(), block.qkvBias, window);
+    }
+
+    for (size_t h = 0; h < nHeads; h++) {
+      for (size_t t = 0; t < window; t++) {
+        const float *row = &ws.qkv[t * 3 * width + h * keyDims];
+        for (size_t k = 0; k < keyDims; k++) {
+          ws.query[t * keyDims + k] = row[k] * queryScale;
+          ws.key[k * window + t] = row[width + k];
+          ws.value[t * keyDims + k] = row[2 * width + k];
+        }
+      }
+      matmul(ws.query.data(), ws.key.data(), ws.scores.data(), window, keyDims,
+             window);
+      softmax_rows(ws.scores.data(), window, window);
+      matmul(ws.scores.data(), ws.value.data(), ws.context.data(), window,
+             window, keyDims);
+      for (size_t t = 0; t < window; t++) {
+        std::copy(ws.context.begin() + t * keyDims,
+                  ws.context.begin() + (t + 1) * keyDims,
+                  ws.heads.begin() + t * width + h * keyDims);
+      }
+    }
+
+    matmul(ws.heads.data(), block.outputKernel.data(), ws.y.data(), window,
+           width, dims);
+    add_bias(ws.y.data(), block.outputBias, window);
+    for (size_t i = 0; i < window * dims; i++) {
+      ws.x[i] += ws.y[i];
+    }
+    layer_norm(ws.x.data(), block);
+
+    matmul(ws.x.data(), block.denseKernel.data(), ws.y.data(), window, dims,
+           dims);
+    add_bias(ws.y.data(), block.denseBias, window);
+    for (size_t i = 0; i < window * dims; i++) {
+      ws.x[i] += std::max(ws.y[i], 0.0f);
+    }
+    layer_norm(ws.x.data(), block);
+  }
+
+  // A Conv1D as wide as the window is one dense layer over the flattened
+  // activations.
+  matmul(ws.x.data(), convKernel.data(), ws.logits.data(), 1, window * dims,
+         nTokens);
+  add_bias(ws.logits.data(), convBias, 1);
+  matmul(ws.logits.data(), outKernel.data(), ws.outLogits.data(), 1, nTokens,
+         nTokens);
+  add_bias(ws.outLogits.data(), outBias, 1);
+  softmax_rows(ws.outLogits.data(), 1, nTokens);
+  for (size_t i = 0; i < ws.ps.size(); i++) {
+    ws.ps[i] = ws.outLogits[tokenOf[i]];
+  }
+  return ws.ps;
+}
+
+double TransformerModel::logprob(const State &state, char32_t c,
+                                 Workspace &workspace) const {
+  return std::log2(probs(state, workspace)[alphabet.serialize(c)]);
+}
+
+const Alphabet<> &TransformerModel::get_alphabet() const { return alphabet; }
+
+size_t TransformerModel::context_size() const { return window; }
+
+size_t TransformerModel::revision() const { return 0; }
+
+MemoryUsage TransformerModel::memory_usage() const {
+  MemoryUsage usage;
+  usage.add("alphabet", alphabet.memory_usage());
+  usage.add("tokenOf", memory::of(tokenOf));
+  usage.add("embeddings", memory::of(embeddings));
+  usage.add("embeddingQkv", memory::of(embeddingQkv));
+  usage.add("blocks", memory::of(blocks));
+  for (const Block &block : blocks) {
+    for (const std::vector<float> *weights :
+         {&block.qkvKernel, &block.qkvBias, &block.outputKernel,
+          &block.outputBias, &block.gamma, &block.beta, &block.denseKernel,
+          &block.denseBias}) {
+      usage.add("blocks.weights", memory::of(*weights));
+    }
+  }
+  usage.add("head", memory::of(convKernel));
+  usage.add("head", memory::of(convBias));
+  usage.add("head", memory::of(outKernel));
+  usage.add("head", memory::of(outBias));
+  return usage;
+}
@@ -1,7 +1,429 @@
 #include "util.hpp"
 
+#include <algorithm>
+#include <cassert>
 #include <cmath>
+#include <limits>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                              \
+    (defined(__x86_64__) || defined(__i386__))
+#define UTIL_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define UTIL_HAVE_AVX2 0
+#endif
 
 double log_add_exp(double v1, double v2) {
-  return std::log2(std::exp2(v1) + std::exp2(v2));
-}
\ No newline at end of file
+  const double hi = std::max(v1, v2);
+  const double lo = std::min(v1, v2);
+  if (hi == -std::numeric_limits<double>::infinity()) {
+    return hi;
+  }
+  return hi + std::log2(1.0 + std::exp2(lo - hi));
+}
+
+double log2_count_slow(size_t k) { return std::log2((double)k); }
+
+namespace {
+std::vector<double> make_log2_table() {
+  std::vector<double> table(LOG2_TABLE_SIZE);
+  table[0] = -std::numeric_limits<double>::infinity();
+  for (size_t k = 1; k < LOG2_TABLE_SIZE; k++) {
+    table[k] = std::log2((double)k);
+  }
+  return table;
+}
+} // namespace
+
+const double *log2_table() {
+  static const std::vector<double> table = make_log2_table();
+  return table.data();
+}
+
+namespace {
+struct Kernels {
+  double (*log_sum_exp)(const double *, size_t);
+  void (*normalize_logprobs)(double *, size_t);
+  void (*logprobs_to_probs)(const double *, double *, size_t);
+  void (*log2_counts)(const size_t *, double *, size_t);
+  void (*matmul)(const float *, const float *, float *, size_t, size_t,
+                 size_t);
+};
+
+double max_scalar(const double *xs, size_t n) {
+  double out = -std::numeric_limits<double>::infinity();
+  for (size_t i = 0; i < n; i++) {
+    out = std::max(out, xs[i]);
+  }
+  return out;
+}
+
+double log_sum_exp_scalar(const double *logps, size_t n) {
+  const double winner = max_scalar(logps, n);
+  if (winner == -std::numeric_limits<double>::infinity()) {
+    return winner;
+  }
+  double total = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    total += std::exp2(logps[i] - winner);
+  }
+  return winner + std::log2(total);
+}
+
+void normalize_logprobs_scalar(double *logps, size_t n) {
+  const double logMass = log_sum_exp_scalar(logps, n);
+  for (size_t i = 0; i < n; i++) {
+    logps[i] -= logMass;
+  }
+}
+
+void logprobs_to_probs_scalar(const double *logps, double *ps, size_t n) {
+  const double winner = max_scalar(logps, n);
+  double total = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    ps[i] = std::exp2(logps[i] - winner);
+    total += ps[i];
+  }
+  for (size_t i = 0; i < n; i++) {
+    ps[i] /= total;
+  }
+}
+
+void log2_counts_scalar(const size_t *counts, double *out, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    out[i] = std::log2((double)counts[i]);
+  }
+}
+
+void matmul_scalar(const float *a, const float *b, float *out, size_t m,
+                   size_t k, size_t n) {
+  for (size_t i = 0; i < m; i++) {
+    float *row = out + i * n;
+    std::fill(row, row + n, 0.0f);
+    for (size_t l = 0; l < k; l++) {
+      const float x = a[i * k + l];
+      const float *bRow = b + l * n;
+      for (size_t j = 0; j < n; j++) {
+        row[j] += x * bRow[j];
+      }
+    }
+  }
+}
+
+const Kernels SCALAR_KERNELS = {log_sum_exp_scalar, normalize_logprobs_scalar,
+                                logprobs_to_probs_scalar, log2_counts_scalar,
+                                matmul_scalar};
+
+#if UTIL_HAVE_AVX2
+// exp2 and log2 have no AVX2 instructions, so both are evaluated as
+// polynomials after splitting off the binary exponent. Both are accurate to a
+// few ulp over the normal double range; exp2 flushes results below 2^-1022
+// to zero, which only ever happens for probabilities that do not matter.
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+AVX2_TARGET inline __m256d exp2_avx2(__m256d x) {
+  const __m256d minX = _mm256_set1_pd(-1022.0);
+  const __m256d underflow = _mm256_cmp_pd(x, minX, _CMP_LT_OQ);
+  x = _mm256_max_pd(_mm256_min_pd(x, _mm256_set1_pd(1023.0)), minX);
+  const __m256d k = _mm256_round_pd(x, _MM_FROUND_TO_NEAREST_INT |
+                                           _MM_FROUND_NO_EXC);
+  // e^y with y = (x - k) ln 2 in [-0.347, 0.347], Taylor series to y^12
+  const __m256d y = _mm256_mul_pd(_mm256_sub_pd(x, k),
+                                  _mm256_set1_pd(0.6931471805599453094));
+  __m256d p = _mm256_set1_pd(1.0 / 479001600.0);
+  const double coeffs[] = {1.0 / 39916800.0, 1.0 / 3628800.0, 1.0 / 362880.0,
+                           1.0 / 40320.0,    1.0 / 5040.0,    1.0 / 720.0,
+                           1.0 / 120.0,      1.0 / 24.0,      1.0 / 6.0,
+                           1.0 / 2.0,        1.0,             1.0};
+  for (double coeff : coeffs) {
+    p = _mm256_fmadd_pd(p, y, _mm256_set1_pd(coeff));
+  }
+  // 2^k by writing k + 1023 straight into the exponent field
+  const __m256d magic = _mm256_set1_pd(4503599627370496.0); // 2^52
+  const __m256i kBits = _mm256_castpd_si256(
+      _mm256_add_pd(_mm256_add_pd(k, _mm256_set1_pd(1023.0)), magic));
+  const __m256d scale = _mm256_castsi256_pd(_mm256_slli_epi64(kBits, 52));
+  return _mm256_andnot_pd(underflow, _mm256_mul_pd(p, scale));
+}
+
+AVX2_TARGET inline __m256d log2_avx2(__m256d x) {
+  const __m256i bits = _mm256_castpd_si256(x);
+  // exponent field as a double via the 2^52 trick
+  const __m256i expField = _mm256_srli_epi64(bits, 52);
+  const __m256i magicBits = _mm256_set1_epi64x(0x4330000000000000);
+  __m256d e = _mm256_sub_pd(
+      _mm256_castsi256_pd(_mm256_or_si256(expField, magicBits)),
+      _mm256_set1_pd(4503599627370496.0 + 1023.0));
+  // mantissa in [1, 2), then folded into [sqrt(1/2), sqrt(2))
+  __m256d m = _mm256_castsi256_pd(_mm256_or_si256(
+      _mm256_and_si256(bits, _mm256_set1_epi64x(0x000fffffffffffff)),
+      _mm256_set1_epi64x(0x3ff0000000000000)));
+  const __m256d big = _mm256_cmp_pd(m, _mm256_set1_pd(1.4142135623730951),
+                                    _CMP_GT_OQ);
+  m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+  e = _mm256_add_pd(e, _mm256_and_pd(big, _mm256_set1_pd(1.0)));
+  // log(m) = 2 atanh(s) with s = (m - 1) / (m + 1), |s| < 0.172
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d s =
+      _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+  const __m256d s2 = _mm256_mul_pd(s, s);
+  __m256d p = _mm256_set1_pd(1.0 / 21.0);
+  const double coeffs[] = {1.0 / 19.0, 1.0 / 17.0, 1.0 / 15.0, 1.0 / 13.0,
+                           1.0 / 11.0, 1.0 / 9.0,  1.0 / 7.0,  1.0 / 5.0,
+                           1.0 / 3.0,  1.0};
+  for (double coeff : coeffs) {
+    p = _mm256_fmadd_pd(p, s2, _mm256_set1_pd(coeff));
+  }
+  // 2 / ln 2
+  const __m256d logm = _mm256_mul_pd(_mm256_mul_pd(p, s),
+                                     _mm256_set1_pd(2.8853900817779268147));
+  const __m256d out = _mm256_add_pd(e, logm);
+  const __m256d zero =
+      _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_EQ_OQ);
+  return _mm256_blendv_pd(
+      out, _mm256_set1_pd(-std::numeric_limits<double>::infinity()), zero);
+}
+
+AVX2_TARGET inline double hsum_avx2(__m256d v) {
+  const __m128d lo = _mm256_castpd256_pd128(v);
+  const __m128d hi = _mm256_extractf128_pd(v, 1);
+  const __m128d pair = _mm_add_pd(lo, hi);
+  return _mm_cvtsd_f64(_mm_add_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+AVX2_TARGET inline double hmax_avx2(__m256d v) {
+  const __m128d lo = _mm256_castpd256_pd128(v);
+  const __m128d hi = _mm256_extractf128_pd(v, 1);
+  const __m128d pair = _mm_max_pd(lo, hi);
+  return _mm_cvtsd_f64(_mm_max_sd(pair, _mm_unpackhi_pd(pair, pair)));
+}
+
+AVX2_TARGET double max_avx2(const double *xs, size_t n) {
+  __m256d acc = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    acc = _mm256_max_pd(acc, _mm256_loadu_pd(xs + i));
+  }
+  double out = hmax_avx2(acc);
+  for (; i < n; i++) {
+    out = std::max(out, xs[i]);
+  }
+  return out;
+}
+
+// sums exp2(xs[i] - shift), also storing the terms when out is non-null
+AVX2_TARGET double sum_exp2_avx2(const double *xs, double shift, double *out,
+                                 size_t n) {
+  const __m256d vShift = _mm256_set1_pd(shift);
+  __m256d acc = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256d p =
+        exp2_avx2(_mm256_sub_pd(_mm256_loadu_pd(xs + i), vShift));
+    if (out) {
+      _mm256_storeu_pd(out + i, p);
+    }
+    acc = _mm256_add_pd(acc, p);
+  }
+  double total = hsum_avx2(acc);
+  for (; i < n; i++) {
+    const double p = std::exp2(xs[i] - shift);
+    if (out) {
+      out[i] = p;
+    }
+    total += p;
+  }
+  return total;
+}
+
+AVX2_TARGET double log_sum_exp_avx2(const double *logps, size_t n) {
+  const double winner = max_avx2(logps, n);
+  if (winner == -std::numeric_limits<double>::infinity()) {
+    return winner;
+  }
+  return winner + std::log2(sum_exp2_avx2(logps, winner, nullptr, n));
+}
+
+AVX2_TARGET void add_avx2(double *xs, double v, size_t n) {
+  const __m256d vv = _mm256_set1_pd(v);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(xs + i, _mm256_add_pd(_mm256_loadu_pd(xs + i), vv));
+  }
+  for (; i < n; i++) {
+    xs[i] += v;
+  }
+}
+
+AVX2_TARGET void normalize_logprobs_avx2(double *logps, size_t n) {
+  add_avx2(logps, -log_sum_exp_avx2(logps, n), n);
+}
+
+AVX2_TARGET void logprobs_to_probs_avx2(const double *logps, double *ps,
+                                        size_t n) {
+  const double winner = max_avx2(logps, n);
+  const double total = sum_exp2_avx2(logps, winner, ps, n);
+  const __m256d scale = _mm256_set1_pd(1.0 / total);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(ps + i, _mm256_mul_pd(_mm256_loadu_pd(ps + i), scale));
+  }
+  for (; i < n; i++) {
+    ps[i] /= total;
+  }
+}
+
+AVX2_TARGET void log2_counts_avx2(const size_t *counts, double *out,
+                                  size_t n) {
+  static_assert(sizeof(size_t) == 8, "log2_counts_avx2 needs 64-bit size_t");
+  // counts below 2^52 convert exactly through the 2^52 trick
+  const __m256i magicBits = _mm256_set1_epi64x(0x4330000000000000);
+  const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256i c = _mm256_loadu_si256((const __m256i *)(counts + i));
+    const __m256d x = _mm256_sub_pd(
+        _mm256_castsi256_pd(_mm256_or_si256(c, magicBits)), magic);
+    _mm256_storeu_pd(out + i, log2_avx2(x));
+  }
+  for (; i < n; i++) {
+    out[i] = std::log2((double)counts[i]);
+  }
+}
+
+// columns j.. of one row of out
+AVX2_TARGET void matmul_row_avx2(const float *aRow, const float *b,
+                                 float *row, size_t k, size_t n, size_t j) {
+  for (; j + 8 <= n; j += 8) {
+    __m256 acc = _mm256_setzero_ps();
+    for (size_t l = 0; l < k; l++) {
+      acc = _mm256_fmadd_ps(_mm256_set1_ps(aRow[l]),
+                            _mm256_loadu_ps(b + l * n + j), acc);
+    }
+    _mm256_storeu_ps(row + j, acc);
+  }
+  for (; j < n; j++) {
+    float sum = 0.0f;
+    for (size_t l = 0; l < k; l++) {
+      sum += aRow[l] * b[l * n + j];
+    }
+    row[j] = sum;
+  }
+}
+
+// Works on 4 x 16 tiles of out held in registers, so that each pair of
+// loads from b feeds eight FMAs.
+AVX2_TARGET void matmul_avx2(const float *a, const float *b, float *out,
+                             size_t m, size_t k, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= m; i += 4) {
+    const float *a0 = a + i * k, *a1 = a0 + k, *a2 = a1 + k, *a3 = a2 + k;
+    size_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+      __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+      __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+      __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+      __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+      for (size_t l = 0; l < k; l++) {
+        const __m256 b0 = _mm256_loadu_ps(b + l * n + j);
+        const __m256 b1 = _mm256_loadu_ps(b + l * n + j + 8);
+        __m256 x = _mm256_set1_ps(a0[l]);
+        c00 = _mm256_fmadd_ps(x, b0, c00);
+        c01 = _mm256_fmadd_ps(x, b1, c01);
+        x = _mm256_set1_ps(a1[l]);
+        c10 = _mm256_fmadd_ps(x, b0, c10);
+        c11 = _mm256_fmadd_ps(x, b1, c11);
+        x = _mm256_set1_ps(a2[l]);
+        c20 = _mm256_fmadd_ps(x, b0, c20);
+        c21 = _mm256_fmadd_ps(x, b1, c21);
+        x = _mm256_set1_ps(a3[l]);
+        c30 = _mm256_fmadd_ps(x, b0, c30);
+        c31 = _mm256_fmadd_ps(x, b1, c31);
+      }
+      float *row = out + i * n + j;
+      _mm256_storeu_ps(row, c00);
+      _mm256_storeu_ps(row + 8, c01);
+      _mm256_storeu_ps(row + n, c10);
+      _mm256_storeu_ps(row + n + 8, c11);
+      _mm256_storeu_ps(row + 2 * n, c20);
+      _mm256_storeu_ps(row + 2 * n + 8, c21);
+      _mm256_storeu_ps(row + 3 * n, c30);
+      _mm256_storeu_ps(row + 3 * n + 8, c31);
+    }
+    for (size_t r = 0; r < 4; r++) {
+      matmul_row_avx2(a + (i + r) * k, b, out + (i + r) * n, k, n, j);
+    }
+  }
+  for (; i < m; i++) {
+    matmul_row_avx2(a + i * k, b, out + i * n, k, n, 0);
+  }
+}
+
+const Kernels AVX2_KERNELS = {log_sum_exp_avx2, normalize_logprobs_avx2,
+                              logprobs_to_probs_avx2, log2_counts_avx2,
+                              matmul_avx2};
+#endif
+
+KernelIsa detect_isa() {
+#if UTIL_HAVE_AVX2
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return KernelIsa::AVX2;
+  }
+#endif
+  return KernelIsa::SCALAR;
+}
+
+KernelIsa activeIsa = detect_isa();
+
+const Kernels &kernels() {
+#if UTIL_HAVE_AVX2
+  if (activeIsa == KernelIsa::AVX2) {
+    return AVX2_KERNELS;
+  }
+#endif
+  return SCALAR_KERNELS;
+}
+} // namespace
+
+double log_sum_exp(const double *logps, size_t n) {
+  return kernels().log_sum_exp(logps, n);
+}
+
+void normalize_logprobs(double *logps, size_t n) {
+  kernels().normalize_logprobs(logps, n);
+}
+
+void logprobs_to_probs(const double *logps, double *ps, size_t n) {
+  kernels().logprobs_to_probs(logps, ps, n);
+}
+
+void log2_counts(const size_t *counts, double *out, size_t n) {
+  kernels().log2_counts(counts, out, n);
+}
+
+void matmul(const float *a, const float *b, float *out, size_t m, size_t k,
+            size_t n) {
+  kernels().matmul(a, b, out, m, k, n);
+}
+
+KernelIsa get_kernel_isa() { return activeIsa; }
+
+bool kernel_isa_supported(KernelIsa isa) {
+  return isa == KernelIsa::SCALAR || detect_isa() == KernelIsa::AVX2;
+}
+
+void set_kernel_isa(KernelIsa isa) {
+  assert(kernel_isa_supported(isa));
+  activeIsa = isa;
+}
+
+const char *kernel_isa_name(KernelIsa isa) {
+  switch (isa) {
+  case KernelIsa::AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}